@@ -0,0 +1,51 @@
+/*  CatalogBuild
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "hashstorage.hpp"
+#include "installcatalog.hpp"
+#include "installindex.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/io/binwritter_stream.hpp"
+#include "spike/master_printer.hpp"
+
+// Need some anchor point, since loosefiles is stored all around
+std::string_view filters[]{
+    "*nimations.pack$",
+};
+
+static AppInfo_s appInfo{
+    .filteredLoad = true,
+    .header = CatalogBuild_DESC " v" CatalogBuild_VERSION
+                                ", " CatalogBuild_COPYRIGHT "Lukas Cone",
+    .filters = filters,
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+bool AppInitContext(const std::string &dataFolder) {
+  hash::LoadStorage(dataFolder + "saboteur_strings.txt");
+  return true;
+}
+
+void AppProcessFile(AppContext *ctx) {
+  const std::string workFolder(ctx->workingFile.GetFolder());
+  const InstallIndex install(workFolder);
+  const AssetCatalogBuilder catalog = BuildInstallCatalog(install, workFolder);
+  BinWritterRef wr(ctx->NewFile("assets.catalog").str);
+  wr.WriteContainer(catalog.Save());
+}
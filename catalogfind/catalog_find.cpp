@@ -0,0 +1,110 @@
+/*  CatalogFind
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "assetcatalog.hpp"
+#include "hashstorage.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/master_printer.hpp"
+#include "spike/reflect/reflector.hpp"
+#include <chrono>
+#include <cinttypes>
+
+std::string_view filters[]{
+    ".catalog$",
+};
+
+struct CatalogFind : ReflectorBase<CatalogFind> {
+  std::string hash;
+  std::string name;
+  std::string types;
+} settings;
+
+REFLECT(CLASS(CatalogFind),
+        MEMBER(hash, "a",
+               ReflDesc{"Find assets by hash (hexadecimal) or by full name, "
+                        "that is hashed."}),
+        MEMBER(name, "n",
+               ReflDesc{"Find assets, whose name contains this text."}),
+        MEMBER(types, "t",
+               ReflDesc{"Find only listed asset types: data, tilepack, mesh, "
+                        "phys, layout, fb, pv, mask, texture, loose, "
+                        "cinematic, lua, animations, dynamic, flash. Empty "
+                        "for all."}));
+
+static AppInfo_s appInfo{
+    .filteredLoad = true,
+    .header = CatalogFind_DESC " v" CatalogFind_VERSION
+                               ", " CatalogFind_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
+    .filters = filters,
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+void AppProcessFile(AppContext *ctx) {
+  const AssetCatalog catalog(std::string(ctx->workingFile.GetFullPath()));
+  const uint32 typeMask = CatalogTypeMask(settings.types);
+  auto startTime = std::chrono::steady_clock::now();
+  std::string report;
+  size_t numFound = 0;
+
+  auto Report = [&](const CatalogRecord &r) {
+    if (!(typeMask >> uint8(r.type) & 1)) {
+      return;
+    }
+
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%08" PRIX32 " %-10s %10" PRIu64
+             " %10" PRIu32 " %10" PRIu32 "  ",
+             r.hash, CATALOG_TYPE_NAMES[uint8(r.type)].data(), r.offset,
+             r.compressedSize, r.uncompressedSize);
+    report.append(buffer)
+        .append(catalog.Archive(r))
+        .append(": ")
+        .append(catalog.Name(r))
+        .push_back('\n');
+    numFound++;
+  };
+
+  if (!settings.hash.empty()) {
+    char *hashEnd = nullptr;
+    const uint32 hash = strtoul(settings.hash.c_str(), &hashEnd, 16);
+
+    if (!*hashEnd) {
+      for (auto &r : catalog.Find(hash)) {
+        Report(r);
+      }
+    }
+
+    const uint32 nameHash = hash::GetHash(settings.hash);
+
+    if (*hashEnd || nameHash != hash) {
+      for (auto &r : catalog.Find(nameHash)) {
+        Report(r);
+      }
+    }
+  } else {
+    catalog.Query(typeMask, settings.name, Report);
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  PrintInfo("    hash type           offset compressed uncompressed\n",
+            report, "Found ", numFound, " of ", catalog.Records().size(),
+            " records in ", elapsed.count(), "ms");
+}
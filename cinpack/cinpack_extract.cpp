@@ -0,0 +1,190 @@
+/*  CinPack
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "cinpack.hpp"
+#include "francemap.hpp"
+#include "hashstorage.hpp"
+#include "installindex.hpp"
+#include "loosefiles.hpp"
+#include "mappedarchive.hpp"
+#include "memstream.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include "spike/master_printer.hpp"
+#include "spike/reflect/reflector.hpp"
+#include "workpool.hpp"
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+std::string_view filters[]{
+    "*inematics.cinpack$",
+    "loosefiles_*.pack$",
+};
+
+struct CinPack : ReflectorBase<CinPack> {
+  bool parallel = false;
+  std::string select;
+} settings;
+
+REFLECT(CLASS(CinPack),
+        MEMBER(parallel, "P",
+               ReflDesc{"Load cinematics from mapped archive on all hardware "
+                        "threads. Files are written in archive order."}),
+        MEMBER(select, "s",
+               ReflDesc{"Extract only cinematics with listed names or hashes, "
+                        "separated by spaces. Empty for all."}));
+
+static AppInfo_s appInfo{
+    .filteredLoad = true,
+    .header =
+        CinPack_DESC " v" CinPack_VERSION ", " CinPack_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
+    .filters = filters,
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+bool AppInitContext(const std::string &dataFolder) {
+  hash::LoadStorage(dataFolder + "saboteur_strings.txt");
+  return true;
+}
+
+struct CinematicItem {
+  uint32 hash;
+  std::string name;
+  const Cinematic *cinematic;
+};
+
+void AppProcessFile(AppContext *ctx) {
+  BinReaderRef rd(ctx->GetStream());
+  MappedArchive archive(ctx);
+  // Owns cinpack data, when archive cannot be mapped
+  std::string cinBuffer;
+  std::string_view cinData;
+
+  auto Load = [&](size_t offset, size_t size) {
+    cinData = archive.Get(offset, size);
+
+    if (!archive.Mapped()) {
+      cinBuffer = cinData;
+      cinData = cinBuffer;
+    }
+  };
+
+  if (ctx->workingFile.GetFilenameExt().ends_with(".cinpack")) {
+    Load(0, rd.GetSize());
+  } else {
+    LooseFilesIndex index = LoadLooseFilesIndex(
+        rd, std::string(ctx->workingFile.GetFullPath()), false,
+        archive.View());
+    const LooseFile *cinpack = index.FindSuffix("inematics.cinpack");
+
+    if (!cinpack) {
+      throw std::runtime_error("cinematics.cinpack not found");
+    }
+
+    Load(cinpack->offset, cinpack->size);
+  }
+
+  MemoryStream cinStream(cinData);
+  const std::map<uint32, Cinematic> cinematics =
+      LoadCinpack(cinStream, cinData.size());
+  std::map<uint32, std::string> names;
+
+  try {
+    const InstallIndex install(std::string(ctx->workingFile.GetFolder()));
+    FranceMapItems franceMap = FindFranceMap(install);
+
+    for (auto &d : franceMap.packs) {
+      if (auto found = cinematics.find(d.hash);
+          !es::IsEnd(cinematics, found)) {
+        found->second.used = true;
+        names.emplace(d.hash, d.name);
+      }
+    }
+  } catch (const es::FileNotFoundError &) {
+    PrintWarning("france.map not found, cinematics are named by their hashes");
+  }
+
+  std::set<std::string> selected;
+
+  {
+    std::stringstream str(ToLower(settings.select));
+    std::string token;
+
+    while (str >> token) {
+      selected.emplace(token);
+    }
+  }
+
+  std::vector<CinematicItem> items;
+  std::string unreferenced;
+
+  for (auto &[hash, cin] : cinematics) {
+    if (size_t(cin.offset) + cin.size > cinData.size()) {
+      throw std::runtime_error("Cinematic out of cinpack bounds: " +
+                               std::to_string(hash::GetStringHash(hash)));
+    }
+
+    std::string hashName = std::to_string(hash::GetStringHash(hash));
+    std::string name = cin.used ? names.at(hash) : hashName;
+
+    if (!cin.used) {
+      unreferenced.append(name).push_back('\n');
+    }
+
+    if (selected.empty() || selected.contains(ToLower(name)) ||
+        selected.contains(ToLower(hashName))) {
+      items.emplace_back(CinematicItem{hash, std::move(name), &cin});
+    }
+  }
+
+  // Sequential reads of archive
+  std::sort(items.begin(), items.end(), [](auto &i0, auto &i1) {
+    return i0.cinematic->offset < i1.cinematic->offset;
+  });
+
+  auto ectx = ctx->ExtractContext();
+  auto Data = [&](const CinematicItem &item) {
+    return cinData.substr(item.cinematic->offset, item.cinematic->size);
+  };
+  auto Write = [&](size_t i) {
+    ectx->NewFile(items[i].name + ".cin");
+    ectx->SendData(Data(items[i]));
+  };
+
+  if (settings.parallel && archive.Mapped()) {
+    RunParallelOrdered(
+        items.size(),
+        [&](size_t i) { MappedArchive::Prefault(Data(items[i])); }, Write);
+  } else {
+    for (size_t i = 0; i < items.size(); i++) {
+      Write(i);
+    }
+  }
+
+  PrintInfo("Extracted ", items.size(), " of ", cinematics.size(),
+            " cinematics");
+
+  if (!unreferenced.empty()) {
+    PrintInfo("Cinematics not referenced by any dynamic pack:\n",
+              unreferenced);
+  }
+}
@@ -0,0 +1,330 @@
+/*  ArchiveDiff
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "fingerprint.hpp"
+#include "hashstorage.hpp"
+#include "megapack.hpp"
+#include "memstream.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include "spike/master_printer.hpp"
+#include "spike/reflect/reflector.hpp"
+#include "tilepack.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+// Need some anchor point, since loosefiles is stored all around
+std::string_view filters[]{
+    "*nimations.pack$",
+};
+
+struct ArchiveDiff : ReflectorBase<ArchiveDiff> {
+  std::string baseInstall;
+  bool extractChanges = false;
+} settings;
+
+REFLECT(CLASS(ArchiveDiff),
+        MEMBER(baseInstall, "b",
+               ReflDesc{"Folder of older install (or archive version) to "
+                        "compare against."}),
+        MEMBER(extractChanges, "x",
+               ReflDesc{"Extract added and changed entries."}));
+
+static AppInfo_s appInfo{
+    .filteredLoad = true,
+    .header = ArchiveDiff_DESC " v" ArchiveDiff_VERSION
+                               ", " ArchiveDiff_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
+    .filters = filters,
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+bool AppInitContext(const std::string &dataFolder) {
+  hash::LoadStorage(dataFolder + "saboteur_strings.txt");
+  return true;
+}
+
+namespace fs = std::filesystem;
+
+struct DiffEntry {
+  uint32 offset;
+  uint32 size;
+};
+
+using DiffEntries = std::map<std::string, DiffEntry>;
+
+enum class ArchiveType {
+  MegaPack,
+  LooseFiles,
+};
+
+struct Archive {
+  std::ifstream str;
+  BinReaderRef_e rd;
+  DiffEntries entries;
+
+  Archive(const fs::path &path, ArchiveType type)
+      : str(path, std::ios::binary), rd(str) {
+    if (str.fail()) {
+      throw es::FileNotFoundError(path.string());
+    }
+
+    if (type == ArchiveType::MegaPack) {
+      for (auto &[index, range] : LoadMegaPack(rd)) {
+        entries.emplace(std::to_string(hash::GetStringHash(index)),
+                        DiffEntry{range.offset, range.size});
+      }
+
+      return;
+    }
+
+    const size_t filesSize = rd.GetSize();
+
+    while (rd.Tell() < filesSize) {
+      uint32 hash;
+      rd.Read(hash);
+      uint32 dataSize;
+      rd.Read(dataSize);
+      char name[120];
+      rd.Read(name);
+      entries.emplace(name, DiffEntry{uint32(rd.Tell()), dataSize});
+      rd.Skip(dataSize);
+      rd.ApplyPadding(16);
+    }
+  }
+
+  void ReadEntry(const DiffEntry &entry, std::string &buffer) {
+    rd.Seek(entry.offset);
+    rd.ReadContainer(buffer, entry.size);
+  }
+};
+
+static std::map<std::string, std::pair<fs::path, ArchiveType>>
+ScanInstall(const fs::path &root) {
+  std::map<std::string, std::pair<fs::path, ArchiveType>> retVal;
+
+  for (auto &e : fs::recursive_directory_iterator(root)) {
+    if (!e.is_regular_file()) {
+      continue;
+    }
+
+    std::string relPath = fs::relative(e.path(), root).generic_string();
+    std::transform(relPath.begin(), relPath.end(), relPath.begin(),
+                   [](char c) { return std::tolower(c); });
+    std::string_view fileName(relPath);
+    fileName.remove_prefix(relPath.find_last_of('/') + 1);
+
+    if (fileName.ends_with(".megapack")) {
+      retVal.emplace(relPath, std::make_pair(e.path(), ArchiveType::MegaPack));
+    } else if (fileName.starts_with("loosefiles_") &&
+               fileName.ends_with(".pack")) {
+      retVal.emplace(relPath,
+                     std::make_pair(e.path(), ArchiveType::LooseFiles));
+    }
+  }
+
+  return retVal;
+}
+
+struct DiffReport {
+  std::string lines;
+  size_t numAdded = 0;
+  size_t numRemoved = 0;
+  size_t numChanged = 0;
+
+  void Added(const std::string &path) {
+    lines.append("+ ").append(path).push_back('\n');
+    numAdded++;
+  }
+
+  void Removed(const std::string &path) {
+    lines.append("- ").append(path).push_back('\n');
+    numRemoved++;
+  }
+
+  void Changed(const std::string &path) {
+    lines.append("* ").append(path).push_back('\n');
+    numChanged++;
+  }
+};
+
+struct DiffContext {
+  DiffReport report;
+  AppExtractContext *ectx = nullptr;
+  std::string inBuffer;
+  std::string outBuffer;
+
+  void ExtractRaw(const std::string &path, const std::string &data) {
+    if (!ectx) {
+      return;
+    }
+
+    ectx->NewFile(path);
+    ectx->SendData(data);
+  }
+
+  void DiffTilePack(const std::string &path, const std::string &base,
+                    const std::string &cur) {
+    MemoryStream baseStr(base);
+    MemoryStream curStr(cur);
+    BinReaderRef_e baseRd(baseStr);
+    BinReaderRef_e curRd(curStr);
+    auto baseIndex = IndexTilePack(baseRd);
+    auto curIndex = IndexTilePack(curRd);
+    curRd.SwapEndian(curIndex.swappedEndian);
+    std::map<std::string, const TileEntry *> baseEntries;
+
+    for (auto &e : baseIndex.entries) {
+      baseEntries.emplace(e.FileName(), &e);
+    }
+
+    const std::string curPath = path + '/';
+
+    for (auto &e : curIndex.entries) {
+      std::string fileName = e.FileName();
+      auto found = baseEntries.find(fileName);
+      std::string_view curData(cur.data() + e.offset, e.size);
+
+      if (es::IsEnd(baseEntries, found)) {
+        report.Added(curPath + fileName);
+      } else {
+        const TileEntry *b = found->second;
+        std::string_view baseData(base.data() + b->offset, b->size);
+        baseEntries.erase(found);
+
+        if (b->size == e.size &&
+            hash::Fingerprint(baseData) == hash::Fingerprint(curData)) {
+          continue;
+        }
+
+        report.Changed(curPath + fileName);
+      }
+
+      if (ectx) {
+        ExtractTileEntry(curRd, e, curPath, ectx, inBuffer, outBuffer);
+      }
+    }
+
+    for (auto &[fileName, _] : baseEntries) {
+      report.Removed(curPath + fileName);
+    }
+  }
+
+  void DiffArchive(const std::string &relPath, Archive *base, Archive *cur) {
+    static const DiffEntries EMPTY;
+    const DiffEntries &baseEntries = base ? base->entries : EMPTY;
+    const DiffEntries &curEntries = cur ? cur->entries : EMPTY;
+    std::string baseData;
+    std::string curData;
+
+    for (auto &[name, entry] : curEntries) {
+      const std::string path = relPath + '/' + name;
+      auto found = baseEntries.find(name);
+
+      if (es::IsEnd(baseEntries, found)) {
+        report.Added(path);
+
+        if (ectx) {
+          cur->ReadEntry(entry, curData);
+          ExtractRaw(path, curData);
+        }
+
+        continue;
+      }
+
+      const bool sameSize = found->second.size == entry.size;
+      cur->ReadEntry(entry, curData);
+      const bool isTilePack = IsTilePack(curData);
+
+      // Tile packs are compared per entry, even if their sizes differ
+      if (!sameSize && !isTilePack) {
+        report.Changed(path);
+        ExtractRaw(path, curData);
+        continue;
+      }
+
+      base->ReadEntry(found->second, baseData);
+
+      if (sameSize &&
+          hash::Fingerprint(baseData) == hash::Fingerprint(curData)) {
+        continue;
+      }
+
+      if (isTilePack && IsTilePack(baseData)) {
+        DiffTilePack(path, baseData, curData);
+      } else {
+        report.Changed(path);
+        ExtractRaw(path, curData);
+      }
+    }
+
+    for (auto &[name, _] : baseEntries) {
+      if (!curEntries.contains(name)) {
+        report.Removed(relPath + '/' + name);
+      }
+    }
+  }
+};
+
+void AppProcessFile(AppContext *ctx) {
+  if (settings.baseInstall.empty()) {
+    throw std::runtime_error("Base install folder is not specified");
+  }
+
+  fs::path curRoot(std::string(ctx->workingFile.GetFolder()));
+  auto baseArchives = ScanInstall(settings.baseInstall);
+  auto curArchives = ScanInstall(curRoot);
+  DiffContext dctx;
+  AppExtractContext *ectx = ctx->ExtractContext("diff");
+
+  if (settings.extractChanges) {
+    dctx.ectx = ectx;
+  }
+
+  for (auto &[relPath, item] : curArchives) {
+    Archive cur(item.first, item.second);
+    auto found = baseArchives.find(relPath);
+
+    if (es::IsEnd(baseArchives, found)) {
+      dctx.DiffArchive(relPath, nullptr, &cur);
+      continue;
+    }
+
+    Archive base(found->second.first, found->second.second);
+    dctx.DiffArchive(relPath, &base, &cur);
+    baseArchives.erase(found);
+  }
+
+  for (auto &[relPath, item] : baseArchives) {
+    Archive base(item.first, item.second);
+    dctx.DiffArchive(relPath, &base, nullptr);
+  }
+
+  ectx->NewFile("diff.txt");
+  ectx->SendData(dctx.report.lines);
+
+  PrintInfo("Added: ", dctx.report.numAdded,
+            ", removed: ", dctx.report.numRemoved,
+            ", changed: ", dctx.report.numChanged);
+}
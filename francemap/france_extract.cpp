@@ -15,28 +15,87 @@
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "assetfilter.hpp"
+#include "cinpack.hpp"
+#include "dedup.hpp"
+#include "dynpack.hpp"
+#include "extractmanifest.hpp"
+#include "extractplan.hpp"
+#include "francemap.hpp"
 #include "hashstorage.hpp"
+#include "installindex.hpp"
+#include "loosefiles.hpp"
+#include "mappedarchive.hpp"
 #include "megapack.hpp"
-#include "meshpack.hpp"
 #include "project.h"
 #include "spike/app_context.hpp"
 #include "spike/except.hpp"
 #include "spike/io/binreader_stream.hpp"
 #include "spike/master_printer.hpp"
 #include "spike/reflect/reflector.hpp"
+#include "tileindex.hpp"
+#include "tilepack.hpp"
+#include "workpool.hpp"
 #include <algorithm>
-#include <cassert>
-#include <set>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <optional>
 
 // Need some anchor point, since loosefiles is stored all around
 std::string_view filters[]{
     "*nimations.pack$",
 };
 
+struct FranceExtract : ReflectorBase<FranceExtract> {
+  bool deduplicate = false;
+  bool parallel = false;
+  bool incremental = false;
+  bool dryRun = false;
+  bool extractTiles = false;
+  bool indexCache = false;
+  std::string region;
+  std::string tileLods;
+  std::string includeTypes;
+  std::string excludeTypes;
+} settings;
+
+REFLECT(CLASS(FranceExtract),
+        MEMBER(deduplicate, "D",
+               ReflDesc{"Write assets repeated across france packs and tiles "
+                        "only once, see dedup_manifest.txt for copies."}),
+        MEMBER(parallel, "P",
+               ReflDesc{"Extract dynamic packs on all hardware threads."}),
+        MEMBER(incremental, "I",
+               ReflDesc{"Skip packs unchanged since last run, whose outputs "
+                        "still exist. Uses extract_manifest.txt."}),
+        MEMBER(dryRun, "n",
+               ReflDesc{"Don't extract anything, only report file counts and "
+                        "sizes per folder from pack tables."}),
+        MEMBER(extractTiles, "T",
+               ReflDesc{"Extract map tile packs from mega0, mega1, mega2. "
+                        "Writes tiles.tidx spatial index."}),
+        MEMBER(indexCache, "c",
+               ReflDesc{"Save loosefiles index next to its archive as .idx "
+                        "and reuse it while the archive is unchanged."}),
+        MEMBER(region, "r",
+               ReflDesc{"Extract only tiles intersecting world space area: "
+                        "\"minX minZ maxX maxZ\". Empty for whole map."}),
+        MEMBER(tileLods, "l",
+               ReflDesc{"Extract only tiles of listed LOD levels, for example "
+                        "\"0\" or \"0 1\". Empty for all levels."}),
+        MEMBER(includeTypes, "i",
+               ReflDesc{"Extract only listed asset types: mesh, phys, layout, "
+                        "fb, pv, flash, texture, mask. Empty for all."}),
+        MEMBER(excludeTypes, "e",
+               ReflDesc{"Skip listed asset types, same names as above."}));
+
 static AppInfo_s appInfo{
     .filteredLoad = true,
     .header = FranceExtract_DESC " v" FranceExtract_VERSION
                                  ", " FranceExtract_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
     .filters = filters,
 };
 
@@ -47,466 +106,381 @@ bool AppInitContext(const std::string &dataFolder) {
   return true;
 }
 
-struct FrancePath {
-  std::string longPath;
-  std::string name0;
-  float unk[12];
-  std::string name1;
-
-  void Read(BinReaderRef_e rd) {
-    rd.ReadContainer(longPath);
-    rd.ReadContainer(name0);
-    rd.Read(unk);
-    rd.ReadContainer(name1);
-
-    longPath = longPath.c_str();
-    name0 = name0.c_str();
-    name1 = name1.c_str();
-
-    hash::GetStringHash(hash::GetHash(longPath), longPath);
-    hash::GetStringHash(hash::GetHash(name0), name0);
-    hash::GetStringHash(hash::GetHash(name1), name1);
-  }
-};
+void AppProcessFile(AppContext *ctx) {
+  std::string workFolder(ctx->workingFile.GetFolder());
+  FranceMapItems dynpacks;
+  int verbosity = appInfo.internalSettings->verbosity;
+  const InstallIndex install(workFolder);
+  std::map<uint32, Cinematic> cinematics;
+  InstallFileStream looseFiles;
+  size_t cinpackOffset = 0;
+
+  try {
+    looseFiles = install.Open("loosefiles_", ".pack");
 
-struct Tile {
-  uint32 hash;
-  uint16 nameLen;
-  float unk[6];
-  uint16 null;
-  uint16 lod; //??
-
-  uint32 null0[13];
-  std::vector<uint32> hashes;
-  uint32 null1;
-
-  void Read(BinReaderRef_e rd) {
-    rd.Read(hash);
-    rd.Read(nameLen);
-    rd.Read(unk);
-    rd.Read(null);
-    rd.Read(lod);
-
-    assert(nameLen == 0);
-    assert(null == 0);
-    assert(lod < 3);
-
-    if (lod == 2) {
-      rd.Read(null0);
-      rd.ReadContainer(hashes);
-      rd.Read(null1);
-      assert(null1 == 0);
+    if (verbosity) {
+      PrintInfo("Found loosefiles package");
     }
-  }
-};
 
-struct DynamicPackDesc {
-  uint32 hash;
-  std::string name;
-  float unk0[6];
-  uint16 unk1[2];
-  uint32 null0[2];
-  uint32 dataStart;
-  uint32 numMeshes;
-  uint32 numTextures;
-  uint32 numPhys;
-  uint32 numLayouts;
-  uint32 numFB;
-  uint32 null1[3];
-  uint32 numPV;
-  uint32 null2;
-  std::vector<uint32> files;
-  uint32 null;
-
-  void Read(BinReaderRef_e rd) {
-    rd.Read(hash);
-    rd.ReadContainer<uint16>(name);
-    name = name.c_str();
-    rd.Read(unk0);
-    rd.Read(unk1);
-    rd.Read(null0);
-    rd.Read(dataStart);
-    rd.Read(numMeshes);
-    rd.Read(numTextures);
-    rd.Read(numPhys);
-    rd.Read(numLayouts);
-    rd.Read(numFB);
-    rd.Read(null1);
-    rd.Read(numPV);
-    rd.Read(null2);
-    rd.ReadContainer(files);
-    rd.Read(null);
-
-    assert(null == 0);
-    assert(!name.empty());
-    assert(null0[0] == 0);
-    assert(null0[1] == 0);
-    assert(null1[0] == 0);
-    assert(null1[1] == 0);
-    assert(null1[2] == 0);
-    assert(null2 == 0);
-  }
-};
+    BinReaderRef rd(*looseFiles.Get());
+    LooseFilesIndex index =
+        LoadLooseFilesIndex(rd, looseFiles.path.string(), settings.indexCache);
 
-struct FranceMapItems {
-  std::set<uint32> tiles;
-  std::vector<DynamicPackDesc> packs;
-};
+    if (const LooseFile *franceMap = index.FindSuffix("rance.map")) {
+      rd.Seek(franceMap->offset);
+      dynpacks = LoadFranceMap(rd);
+    }
 
-FranceMapItems LoadFranceMap(BinReaderRef_e rd) {
-  static constexpr uint32 MAP6_ID = CompileFourCC("6PAM");
-  static constexpr uint32 MAP6_ID_BE = CompileFourCC("MAP6");
-
-  uint32 id;
-  rd.Read(id);
-  if (id != MAP6_ID) {
-    if (id == MAP6_ID_BE) {
-      rd.SwapEndian(true);
-    } else {
-      throw es::InvalidHeaderError(id);
+    if (const LooseFile *cinpack = index.FindSuffix("inematics.cinpack")) {
+      rd.Seek(cinpack->offset);
+      cinpackOffset = cinpack->offset;
+      cinematics = LoadCinpack(rd, cinpack->size);
+    }
+  } catch (const es::FileNotFoundError &) {
+    if (verbosity) {
+      PrintInfo("loosefiles package not found, looking up france.map");
     }
+
+    auto found = install.Open("france.map");
+    dynpacks = LoadFranceMap(*found.Get());
+
+    if (verbosity) {
+      PrintInfo("loosefiles package not found, looking up cinematics.cinpack");
+    }
+
+    looseFiles = install.Open("cinematics.cinpack");
+    BinReaderRef rd_(*looseFiles.Get());
+    cinematics = LoadCinpack(rd_, rd_.GetSize());
   }
 
-  std::string mapName;
-  rd.ReadString(mapName);
+  if (dynpacks.packs.empty() && dynpacks.tiles.empty()) {
+    throw std::runtime_error("france.map not found");
+  }
 
-  uint32 numTiles;
-  rd.Read(numTiles);
-  const bool isDLC = numTiles == 0;
+  struct Megapacks {
+    InstallFileStream stream;
+    BinReaderRef_e rd;
+    std::map<uint32, FileRange> files;
 
-  if (isDLC) {
-    rd.Read(numTiles);
-  } else {
-    uint32 unk0;
-    uint32 numPaths;
-    uint32 unk1;
+    Megapacks(InstallFileStream &&stream_)
+        : stream(std::move(stream_)), rd(*stream.Get()),
+          files(LoadMegaPack(rd)) {}
+  };
 
-    rd.Read(unk0);
-    rd.Read(numPaths);
-    rd.Read(unk1);
+  std::vector<Megapacks> megapacks;
 
-    FrancePath dummy;
+  if (verbosity) {
+    PrintInfo("Looking up mega0.megapack");
+  }
+  megapacks.reserve(3);
+  megapacks.emplace_back(install.Open("mega0.megapack"));
 
-    for (size_t i = 0; i < numPaths; ++i) {
-      rd.Read(dummy);
+  if (settings.extractTiles) {
+    for (auto name : {"mega1.megapack", "mega2.megapack"}) {
+      try {
+        megapacks.emplace_back(install.Open(name));
+      } catch (const es::FileNotFoundError &) {
+      }
     }
-
-    float unk2[18];
-    rd.Read(unk2);
-    uint16 unk3[6];
-    rd.Read(unk3);
   }
 
-  std::set<uint32> tileHashes;
-  Tile dummyTile;
+  // Dry run doesn't create any output
+  std::optional<ExtractPlan> plan;
+  AppExtractContext *output = nullptr;
+  AppExtractContext *ectx = nullptr;
+  std::optional<DedupExtractContext> dedup;
 
-  for (size_t i = 0; i < numTiles; i++) {
-    rd.Read(dummyTile);
+  if (settings.dryRun) {
+    plan.emplace();
+  } else {
+    ectx = output = ctx->ExtractContext("france");
 
-    if (dummyTile.lod < 2) {
-      tileHashes.emplace(dummyTile.hash);
+    if (settings.deduplicate) {
+      ectx = &dedup.emplace(ectx);
     }
   }
 
-  std::vector<DynamicPackDesc> dyn0;
-  rd.ReadContainer(dyn0);
-  std::vector<DynamicPackDesc> dyn1;
-  rd.ReadContainer(dyn1);
+  const AssetFilter filter(settings.includeTypes, settings.excludeTypes);
 
-  dyn0.insert(dyn0.end(), dyn1.begin(), dyn1.end());
+  // Megapacks are mapped once, stored entries are sent as views of mappings.
+  // Every worker reads them and cinpack through its own streams
+  std::deque<SharedMapping> mappings;
 
-  return {tileHashes, dyn0};
-}
+  for (auto &m : megapacks) {
+    mappings.emplace_back(m.stream.path.string());
+  }
 
-struct DynFile {
-  uint32 hash0;
-  uint32 offset;
-  uint32 size;
-  uint32 uncompressedSize;
-  uint32 null;
-  uint32 hash1;
-};
+  struct PackReaders {
+    std::vector<std::unique_ptr<std::istream>> megapacks;
+    std::ifstream cinpacks;
+    std::string inBuffer;
+    std::string outBuffer;
+  };
 
-template <> void FByteswapper(DynFile &id, bool) {
-  FByteswapper(id.hash0);
-  FByteswapper(id.offset);
-  FByteswapper(id.size);
-  FByteswapper(id.uncompressedSize);
-  FByteswapper(id.hash1);
-}
+  std::vector<PackReaders> readers(
+      settings.parallel ? NumParallelWorkers(dynpacks.packs.size()) : 1);
 
-struct Cinematic {
-  uint32 offset;
-  uint32 size = 0;
-  mutable bool used = false;
-};
+  for (auto &r : readers) {
+    for (auto &m : mappings) {
+      r.megapacks.emplace_back(m.NewStream());
+    }
 
-std::map<uint32, Cinematic> LoadCinpack(BinReaderRef_e rd, size_t endOffset) {
-  uint32 id;
-  rd.Read(id);
-  if (id != 0xC) {
-    if (id == 0xC000000) {
-      rd.SwapEndian(true);
-    } else {
-      throw es::InvalidHeaderError(id);
+    if (!cinematics.empty()) {
+      r.cinpacks.open(looseFiles.path, std::ios::binary);
     }
   }
 
-  uint32 numItems;
-  rd.Read(numItems);
+  // With namesOnly, mesh names are registered without extracting anything
+  auto ExtractFromPacks = [&](BinReaderRef_e rd, const DynamicPackDesc &d,
+                              AppExtractContext *ectx, PackReaders &r,
+                              bool namesOnly) {
+    const DynamicPackTables tables = ReadDynamicPackTables(rd, d);
 
-  std::map<uint32, Cinematic> items;
-  std::vector<uint32> offsets;
+    if (plan) {
+      PlanDynamicPack(rd, tables, d.name, *plan, filter);
+      return;
+    }
 
-  for (uint32 i = 0; i < numItems; i++) {
-    uint32 id;
-    uint32 offset;
-    bool unk;
+    ExtractDynamicPack(rd, tables, d.name + '/', ectx, r.inBuffer,
+                       r.outBuffer, filter, namesOnly);
+  };
 
-    rd.Read(id);
-    rd.Read(offset);
-    rd.Read(unk);
+  std::optional<ExtractManifest> manifest;
 
-    items.emplace(id, Cinematic{offset});
-    offsets.emplace_back(offset);
+  if (settings.incremental && !plan) {
+    manifest.emplace(output, workFolder + "france/",
+                     std::string(FranceExtract_VERSION) + ' ' +
+                         settings.includeTypes + ':' + settings.excludeTypes +
+                         (dedup ? " d" : ""),
+                     dedup ? &*dedup : nullptr);
   }
 
-  std::sort(offsets.begin(), offsets.end());
-
-  for (auto &[_, item] : items) {
-    auto nextOffset =
-        std::upper_bound(offsets.begin(), offsets.end(), item.offset);
+  auto ArchiveName = [&](const std::filesystem::path &path) {
+    return std::filesystem::relative(path, workFolder).generic_string();
+  };
 
-    if (es::IsEnd(offsets, nextOffset)) {
-      item.size = endOffset - item.offset;
-    } else {
-      item.size = *nextOffset - item.offset;
+  // With incremental setting, unchanged packs only register mesh names
+  auto ExtractSource = [&](BinReaderRef_e rd, const std::string &archive,
+                           uint64 size, const DynamicPackDesc &d,
+                           AppExtractContext *ectx, PackReaders &r,
+                           bool namesOnly) {
+    if (namesOnly || !manifest) {
+      ExtractFromPacks(rd, d, ectx, r, namesOnly);
+      return;
     }
-  }
-
-  return items;
-}
-
-static constexpr uint32 SBLA_ID = CompileFourCC("ALBS");
-
-void AppProcessFile(AppContext *ctx) {
-  std::string workFolder(ctx->workingFile.GetFolder());
-  FranceMapItems dynpacks;
-  int verbosity = appInfo.internalSettings->verbosity;
-  std::map<uint32, Cinematic> cinematics;
-  AppContextFoundStream looseFiles;
-  BinReaderRef_e cinpacks;
 
-  try {
-    looseFiles = ctx->FindFile(workFolder, "loosefiles_*.pack$");
+    const ManifestSource source =
+        MakeManifestSource(rd, archive, size, r.inBuffer);
 
-    if (verbosity) {
-      PrintInfo("Found loosefiles package");
+    if (manifest->Unchanged(source)) {
+      ExtractFromPacks(rd, d, ectx, r, true);
+      return;
     }
 
-    BinReaderRef rd(*looseFiles.Get());
-    const size_t filesSize = rd.GetSize();
+    ManifestExtractContext mctx(ectx);
+    ExtractFromPacks(rd, d, &mctx, r, false);
+    manifest->Add(source, std::move(mctx.outputs));
+  };
 
-    while (rd.Tell() < filesSize) {
-      uint32 hash;
-      rd.Read(hash);
-      uint32 dataSize;
-      rd.Read(dataSize);
-      char name[120];
-      rd.Read(name);
-      std::string_view strName(name);
-      if (strName.ends_with("rance.map")) {
-        rd.Push();
-        dynpacks = LoadFranceMap(rd);
-        rd.Pop();
-      } else if (strName.ends_with("inematics.cinpack")) {
-        rd.Push();
-        cinpacks = rd;
-        cinpacks.SetRelativeOrigin(rd.Tell());
-        cinematics = LoadCinpack(rd, dataSize);
-        rd.Pop();
+  auto ExtractPack = [&](const DynamicPackDesc &d, AppExtractContext *ectx,
+                         PackReaders &r, bool namesOnly) {
+    for (size_t m = 0; m < megapacks.size(); m++) {
+      auto &files = megapacks[m].files;
+
+      if (auto found = files.find(d.hash); !es::IsEnd(files, found)) {
+        found->second.used = true;
+        BinReaderRef_e rd(*r.megapacks[m]);
+        rd.Seek(found->second.offset);
+        ExtractSource(rd, ArchiveName(megapacks[m].stream.path),
+                      found->second.size, d, ectx, r, namesOnly);
+        return;
       }
-      rd.Skip(dataSize);
-      rd.ApplyPadding(16);
-    }
-  } catch (const es::FileNotFoundError &) {
-    if (verbosity) {
-      PrintInfo("loosefiles package not found, looking up france.map");
     }
 
-    try {
-      auto found = ctx->FindFile(workFolder, "rance.map$");
-      dynpacks = LoadFranceMap(*found.Get());
-    } catch (const es::FileNotFoundError &) {
-      auto found = ctx->FindFile(workFolder, "FRANCE.map$");
-      dynpacks = LoadFranceMap(*found.Get());
+    if (auto path = install.Find(std::to_string(d.hash) + ".pack")) {
+      std::ifstream stream(*path, std::ios::binary);
+      ExtractSource(stream, ArchiveName(*path),
+                    std::filesystem::file_size(*path), d, ectx, r, namesOnly);
+      return;
     }
 
-    if (verbosity) {
-      PrintInfo("loosefiles package not found, looking up cinematics.cinpack");
+    if (namesOnly) {
+      return;
     }
 
-    looseFiles = ctx->FindFile(workFolder, "inematics.cinpack$");
-    BinReaderRef rd_(*looseFiles.Get());
-    cinematics = LoadCinpack(rd_, rd_.GetSize());
-    cinpacks = rd_;
-  }
+    if (auto found = cinematics.find(d.hash); !es::IsEnd(cinematics, found)) {
+      found->second.used = true;
 
-  if (dynpacks.packs.empty() && dynpacks.tiles.empty()) {
-    throw std::runtime_error("france.map not found");
-  }
+      if (plan) {
+        const std::string_view name(d.name);
+        plan->Add(name.substr(0, name.find_last_of('/') + 1),
+                  found->second.size, found->second.size);
+        return;
+      }
 
-  struct Megapacks {
-    AppContextFoundStream stream;
-    BinReaderRef_e rd;
-    std::map<uint32, FileRange> files;
+      BinReaderRef_e rd(r.cinpacks);
+      rd.Seek(cinpackOffset + found->second.offset);
+      rd.ReadContainer(r.inBuffer, found->second.size);
+      const ManifestSource source{
+          ArchiveName(looseFiles.path), cinpackOffset + found->second.offset,
+          found->second.size, hash::Fingerprint(r.inBuffer)};
 
-    Megapacks(AppContextFoundStream &&stream_)
-        : stream(std::move(stream_)), rd(*stream.Get()),
-          files(LoadMegaPack(rd)) {}
-  };
+      if (manifest && manifest->Unchanged(source)) {
+        return;
+      }
 
-  std::vector<Megapacks> megapacks;
+      ectx->NewFile(d.name + ".cin");
+      ectx->SendData(r.inBuffer);
 
-  if (verbosity) {
-    PrintInfo("Looking up mega0.megapack");
-  }
-  megapacks.emplace_back(ctx->FindFile(workFolder, "ega0.megapack$"));
-
-  auto ectx = ctx->ExtractContext("france");
-  std::string inBuffer;
-  std::string outBuffer;
-
-  for (auto &d : dynpacks.packs) {
-    std::string curPath = d.name;
-    curPath.push_back('/');
-
-    auto ExtractFromPacks = [&](BinReaderRef_e rd) {
-      static constexpr uint32 SBLA_ID = CompileFourCC("ALBS");
-      static constexpr uint32 SBLA_ID_BE = CompileFourCC("SBLA");
-      uint32 id;
-      rd.Read(id);
-
-      if (id != SBLA_ID) {
-        if (id == SBLA_ID_BE) {
-          rd.SwapEndian(true);
-        } else {
-          throw es::InvalidHeaderError(id);
-        }
+      if (manifest) {
+        manifest->Add(source, {d.name + ".cin"});
       }
 
-      const char *dtex = rd.SwappedEndian() ? "XETD" : "DTEX";
+      return;
+    }
 
-      rd.Read(id); // dummy
-      assert(id == 0);
-      std::vector<DynFile> meshes;
-      rd.ReadContainer(meshes, d.numMeshes);
+    if (plan) {
+      plan->Missing(d.name);
+      return;
+    }
 
-      std::vector<DynFile> phys;
-      rd.ReadContainer(phys, d.numPhys);
+    printerror(
+        "Couldn't find: " << std::to_string(hash::GetStringHash(d.hash)));
+  };
 
-      // No idea about order
-      std::vector<DynFile> layouts;
-      rd.ReadContainer(layouts, d.numLayouts);
+  if (settings.parallel && !plan) {
+    // Register all mesh names first, so names of other assets don't depend
+    // on order in which packs are finished
+    RunParallel(dynpacks.packs.size(), [&](size_t i, size_t w) {
+      ExtractPack(dynpacks.packs[i], nullptr, readers[w], true);
+    });
 
-      std::vector<DynFile> fbData;
-      rd.ReadContainer(fbData, d.numFB);
+    std::mutex ectxMutex;
 
-      std::vector<DynFile> pvData;
-      rd.ReadContainer(pvData, d.numPV);
+    RunParallel(dynpacks.packs.size(), [&](size_t i, size_t w) {
+      BufferedExtractContext bctx(ectx);
+      ExtractPack(dynpacks.packs[i], &bctx, readers[w], false);
+      bctx.Flush(ectxMutex);
+    });
+  } else {
+    for (auto &d : dynpacks.packs) {
+      ExtractPack(d, ectx, readers.front(), false);
+    }
+  }
 
-      std::vector<DynFile> textures;
-      rd.ReadContainer(textures, d.numTextures);
+  if (settings.extractTiles) {
+    auto startTime = std::chrono::steady_clock::now();
+    // Index is reused from default output folder, when tiles didn't change
+    const TileIndex tileIndex =
+        LoadTileIndex(workFolder + "france/tiles.tidx", dynpacks.tiles);
 
-      std::map<uint32, std::string> meshNames;
+    if (ectx) {
+      ectx->NewFile("tiles.tidx");
+      ectx->SendData(tileIndex.Save());
+    }
 
-      for (auto &df : meshes) {
-        auto mName = ExtractMeshPack(rd, curPath, ectx, inBuffer, outBuffer);
-        hash::GetStringHash(df.hash0, mName);
-      }
+    size_t numTiles = 0;
+    size_t readBytes = 0;
+    size_t inflatedBytes = 0;
+    std::string inBuffer;
+    std::string outBuffer;
 
-      for (auto &df : phys) {
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".phy");
-        Extract(ectx, df.size, df.uncompressedSize, inBuffer, outBuffer, rd);
-      }
+    struct TileSource {
+      Megapacks *pack;
+      FileRange *range;
+      uint32 hash;
+    };
 
-      for (auto &df : layouts) {
-        rd.ReadContainer(inBuffer, df.size);
+    std::vector<TileSource> sources;
 
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".lay");
-        ectx->SendData(inBuffer);
+    auto FindTile = [&](const TileRecord &t) {
+      for (auto &m : megapacks) {
+        if (auto found = m.files.find(t.hash); !es::IsEnd(m.files, found)) {
+          sources.emplace_back(TileSource{&m, &found->second, t.hash});
+          return;
+        }
       }
 
-      for (auto &df : fbData) {
-        rd.ReadContainer(inBuffer, df.size);
-
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".fb");
-        ectx->SendData(inBuffer);
+      if (plan) {
+        plan->Missing("tiles/" + std::to_string(hash::GetStringHash(t.hash)));
+        return;
       }
 
-      for (auto &df : pvData) {
-        rd.ReadContainer(inBuffer, df.size);
+      printerror("Couldn't find tile: "
+                 << std::to_string(hash::GetStringHash(t.hash)));
+    };
 
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".pv");
-        ectx->SendData(inBuffer);
+    tileIndex.Query(TileBox::FromString(settings.region),
+                    TileLodMask(settings.tileLods), FindTile);
+
+    // Sequential reads per megapack
+    std::sort(sources.begin(), sources.end(), [](auto &a, auto &b) {
+      return a.pack < b.pack ||
+             (a.pack == b.pack && a.range->offset < b.range->offset);
+    });
+
+    for (auto &[m, range, tileHash] : sources) {
+      range->used = true;
+      // Tiles are read sequentially, through streams of first reader
+      BinReaderRef_e rd(*readers.front().megapacks.at(m - megapacks.data()));
+      rd.Seek(range->offset);
+      const std::string curPath =
+          "tiles/" + std::to_string(hash::GetStringHash(tileHash)) + '/';
+
+      if (plan) {
+        PlanTilePack(rd, curPath, *plan, filter);
+        continue;
       }
 
-      for (auto &df : textures) {
-        if (!df.size) {
-          continue;
-        }
+      std::optional<ManifestSource> source;
+      ManifestExtractContext mctx(ectx);
 
-        rd.ReadContainer(inBuffer, df.size);
+      if (manifest) {
+        source = MakeManifestSource(rd, ArchiveName(m->stream.path),
+                                    range->size, inBuffer);
 
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".dtex");
-        ectx->SendData(dtex);
-        ectx->SendData(inBuffer);
+        if (manifest->Unchanged(*source)) {
+          continue;
+        }
       }
-    };
 
-    bool found_ = false;
+      const TilePackIndex index = IndexTilePack(rd);
+      rd.SwapEndian(index.swappedEndian);
 
-    for (auto &m : megapacks) {
-      if (auto found = m.files.find(d.hash); !es::IsEnd(m.files, found)) {
-        found->second.used = true;
-        m.rd.Seek(found->second.offset);
-        ExtractFromPacks(m.rd);
-        found_ = true;
-        break;
-      }
-    }
+      for (auto &e : index.entries) {
+        if (!filter.Accepts(TileAssetType(e.type))) {
+          continue;
+        }
 
-    if (!found_)
-      try {
-        auto stream =
-            ctx->FindFile(workFolder, std::to_string(d.hash) + ".pack");
-        ExtractFromPacks(*stream.Get());
-        found_ = true;
-      } catch (const es::FileNotFoundError &) {
+        ExtractTileEntry(rd, e, curPath, &mctx, inBuffer, outBuffer);
+        inflatedBytes += e.uncompressedSize;
       }
 
-    if (!found_) {
-      if (auto found = cinematics.find(d.hash); !es::IsEnd(cinematics, found)) {
-        cinpacks.Seek(found->second.offset);
-        cinpacks.ReadContainer(inBuffer, found->second.size);
-        found->second.used = true;
-        found_ = true;
-        auto fileName = curPath;
-        fileName.pop_back();
-        ectx->NewFile(fileName + ".cin");
-        ectx->SendData(inBuffer);
+      if (source) {
+        manifest->Add(*source, std::move(mctx.outputs));
       }
-    }
 
-    if (!found_) {
-      printerror(
-          "Couldn't find: " << std::to_string(hash::GetStringHash(d.hash)));
+      readBytes += range->size;
+      numTiles++;
     }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - startTime;
+    PrintInfo("Extracted ", numTiles, " of ", tileIndex.tiles.size(),
+              " tiles, read ", readBytes, " bytes, inflated ", inflatedBytes,
+              " bytes in ", elapsed.count(), "s");
+  }
+
+  if (manifest) {
+    manifest->Save(ectx);
+  }
+
+  if (plan) {
+    plan->Print();
+  }
+
+  if (dedup) {
+    dedup->Finish();
   }
 
   for (auto &m : megapacks) {
@@ -14,26 +14,70 @@
     You should have received a copy of the GNU General Public License
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
+#include "assetfilter.hpp"
+#include "dedup.hpp"
+#include "dynpack.hpp"
+#include "extractmanifest.hpp"
+#include "extractplan.hpp"
+#include "globalmap.hpp"
 #include "hashstorage.hpp"
+#include "installindex.hpp"
+#include "loosefiles.hpp"
+#include "mappedarchive.hpp"
 #include "megapack.hpp"
-#include "meshpack.hpp"
 #include "project.h"
 #include "spike/app_context.hpp"
 #include "spike/except.hpp"
 #include "spike/io/binreader_stream.hpp"
 #include "spike/master_printer.hpp"
 #include "spike/reflect/reflector.hpp"
-#include <cassert>
+#include "workpool.hpp"
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <optional>
 
 // Need some anchor point, since loosefiles is stored all around
 std::string_view filters[]{
     "*nimations.pack$",
 };
 
+struct GlobalExtract : ReflectorBase<GlobalExtract> {
+  bool deduplicate = false;
+  bool parallel = false;
+  bool incremental = false;
+  bool dryRun = false;
+  bool indexCache = false;
+  std::string includeTypes;
+  std::string excludeTypes;
+} settings;
+
+REFLECT(CLASS(GlobalExtract),
+        MEMBER(deduplicate, "D",
+               ReflDesc{"Write assets shared by global packs only once, "
+                        "skipped copies are listed in dedup_manifest.txt."}),
+        MEMBER(parallel, "P",
+               ReflDesc{"Extract dynamic packs on all hardware threads."}),
+        MEMBER(incremental, "I",
+               ReflDesc{"Skip packs unchanged since last run, whose outputs "
+                        "still exist. Uses extract_manifest.txt."}),
+        MEMBER(dryRun, "n",
+               ReflDesc{"Don't extract anything, only report file counts and "
+                        "sizes per folder from pack tables."}),
+        MEMBER(indexCache, "c",
+               ReflDesc{"Save loosefiles index next to its archive as .idx "
+                        "and reuse it while the archive is unchanged."}),
+        MEMBER(includeTypes, "i",
+               ReflDesc{"Extract only listed asset types: mesh, phys, layout, "
+                        "fb, pv, flash, texture, mask. Empty for all."}),
+        MEMBER(excludeTypes, "e",
+               ReflDesc{"Skip listed asset types, same names as above."}));
+
 static AppInfo_s appInfo{
     .filteredLoad = true,
     .header = GlobalExtract_DESC " v" GlobalExtract_VERSION
                                  ", " GlobalExtract_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
     .filters = filters,
 };
 
@@ -44,143 +88,40 @@ bool AppInitContext(const std::string &dataFolder) {
   return true;
 }
 
-struct DynamicPackDesc {
-  uint32 assetIndex;
-  std::string name;
-  uint8 data[28];
-  std::vector<FileId> textures;
-  std::vector<FileId> meshes;
-  uint32 dataOffset;
-  uint32 numMehes;
-  uint32 numTextures;
-  uint32 numPhys;
-  uint32 unk0;
-  uint32 unk1;
-  uint32 unk2;
-  uint32 unk3;
-  uint32 numFlashes;
-  uint32 unk5;
-  uint32 unk6;
-  uint32 unk7;
-  uint32 unk8;
-
-  void Read(BinReaderRef_e rd) {
-    rd.Read(assetIndex);
-    rd.ReadContainer<uint16>(name);
-    name = name.c_str();
-    rd.Read(data);
-    rd.ReadContainer(textures);
-    rd.ReadContainer(meshes);
-    rd.Read(dataOffset);
-    rd.Read(numMehes);
-    rd.Read(numTextures);
-    rd.Read(numPhys);
-    rd.Read(unk0);
-    rd.Read(unk1);
-    rd.Read(unk2);
-    rd.Read(unk3);
-    rd.Read(numFlashes);
-    rd.Read(unk5);
-    rd.Read(unk6);
-    rd.Read(unk7);
-    rd.Read(unk8);
-
-    assert(unk0 == 0);
-    assert(unk1 == 0);
-    assert(unk2 == 0);
-    assert(unk3 == 0);
-    assert(unk5 == 0);
-    assert(unk6 == 0);
-    assert(unk7 == 0);
-    assert(unk8 == 0);
-
-    if (numFlashes) {
-      assert(numMehes == 0);
-      assert(numPhys == 0);
-    }
-  }
-};
-
-std::vector<DynamicPackDesc> LoadGlobalMap(BinReaderRef_e rd) {
-  static constexpr uint32 MAP6_ID = CompileFourCC("6PAM");
-  static constexpr uint32 MAP6_ID_BE = CompileFourCC("MAP6");
-
-  uint32 id;
-  rd.Read(id);
-  if (id != MAP6_ID) {
-    if (id == MAP6_ID_BE) {
-      rd.SwapEndian(true);
-    } else {
-      throw es::InvalidHeaderError(id);
-    }
-  }
-
-  uint32 numDynamics;
-  rd.Read(numDynamics);
-  std::vector<DynamicPackDesc> idkPreloadPatterns;
-  rd.ReadContainer(idkPreloadPatterns);
-  std::vector<DynamicPackDesc> patterns;
-  rd.ReadContainer(patterns);
-
-  std::vector<DynamicPackDesc> dynamics;
-  rd.ReadContainer(dynamics, numDynamics);
-
-  dynamics.insert(dynamics.end(), patterns.begin(), patterns.end());
-
-  return dynamics;
-}
-
-struct DynFile {
-  uint32 hash0;
-  uint32 offset;
-  uint32 size;
-  uint32 uncompressedSize;
-  uint32 null;
-  uint32 hash1;
-};
-
-template <> void FByteswapper(DynFile &id, bool) {
-  FByteswapper(id.hash0);
-  FByteswapper(id.offset);
-  FByteswapper(id.size);
-  FByteswapper(id.uncompressedSize);
-  FByteswapper(id.hash1);
-}
-
 void AppProcessFile(AppContext *ctx) {
   std::string workFolder(ctx->workingFile.GetFolder());
-  std::vector<DynamicPackDesc> dynpacks;
+  std::vector<GlobalPackDesc> dynpacks;
   int verbosity = appInfo.internalSettings->verbosity;
+  const InstallIndex install(workFolder);
 
   try {
-    auto found = ctx->FindFile(workFolder, "loosefiles_*.pack$");
+    auto found = install.Open("loosefiles_", ".pack");
 
     if (verbosity) {
       PrintInfo("Found loosefiles package");
     }
 
     BinReaderRef rd(*found.Get());
-    const size_t filesSize = rd.GetSize();
-
-    while (rd.Tell() < filesSize) {
-      uint32 hash;
-      rd.Read(hash);
-      uint32 dataSize;
-      rd.Read(dataSize);
-      char name[120];
-      rd.Read(name);
-      if (std::string_view(name).ends_with("lobal.map")) {
+
+    // Without index cache, headers are walked only until global.map
+    if (!settings.indexCache) {
+      if (FindLooseFile(rd, "lobal.map")) {
+        dynpacks = LoadGlobalMap(rd);
+      }
+    } else {
+      LooseFilesIndex index =
+          LoadLooseFilesIndex(rd, found.path.string(), true);
+
+      if (const LooseFile *globalMap = index.FindSuffix("lobal.map")) {
+        rd.Seek(globalMap->offset);
         dynpacks = LoadGlobalMap(rd);
-        break;
       }
-      rd.Skip(dataSize);
-      rd.ApplyPadding(16);
     }
   } catch (const es::FileNotFoundError &) {
     if (verbosity) {
       PrintInfo("loosefiles package not found, looking up global.map");
     }
-    auto found = ctx->FindFile(workFolder, "lobal.map$");
+    auto found = install.Open("global.map");
     dynpacks = LoadGlobalMap(*found.Get());
   }
 
@@ -189,11 +130,11 @@ void AppProcessFile(AppContext *ctx) {
   }
 
   struct Megapacks {
-    AppContextFoundStream stream;
+    InstallFileStream stream;
     BinReaderRef_e rd;
     std::map<uint32, FileRange> files;
 
-    Megapacks(AppContextFoundStream &&stream_)
+    Megapacks(InstallFileStream &&stream_)
         : stream(std::move(stream_)), rd(*stream.Get()),
           files(LoadMegaPack(rd)) {}
   };
@@ -203,110 +144,167 @@ void AppProcessFile(AppContext *ctx) {
   if (verbosity) {
     PrintInfo("Looking up dynamic0.megapack");
   }
-  megapacks.emplace_back(ctx->FindFile(workFolder, "ynamic0.megapack$"));
+  megapacks.emplace_back(install.Open("dynamic0.megapack"));
 
   try {
-    megapacks.emplace_back(ctx->FindFile(workFolder, "alettes0.megapack$"));
+    megapacks.emplace_back(install.Open("palettes0.megapack"));
   } catch (const es::FileNotFoundError &) {
   }
 
-  auto ectx = ctx->ExtractContext("global");
-  std::string inBuffer;
-  std::string outBuffer;
-
-  for (auto &d : dynpacks) {
-    std::string curPath = d.name;
-    curPath.push_back('/');
-
-    auto ExtractFromPacks = [&](BinReaderRef_e rd) {
-      static constexpr uint32 SBLA_ID = CompileFourCC("ALBS");
-      static constexpr uint32 SBLA_ID_BE = CompileFourCC("SBLA");
-      uint32 id;
-      rd.Read(id);
-
-      if (id != SBLA_ID) {
-        if (id == SBLA_ID_BE) {
-          rd.SwapEndian(true);
-        } else {
-          throw es::InvalidHeaderError(id);
-        }
-      }
+  // Dry run doesn't create any output
+  std::optional<ExtractPlan> plan;
+  AppExtractContext *output = nullptr;
+  AppExtractContext *ectx = nullptr;
+  std::optional<DedupExtractContext> dedup;
 
-      const char *dtex = rd.SwappedEndian() ? "XETD" : "DTEX";
+  if (settings.dryRun) {
+    plan.emplace();
+  } else {
+    ectx = output = ctx->ExtractContext("global");
 
-      rd.Read(id); // dummy
-      assert(id == 0);
-      std::vector<DynFile> meshes;
-      rd.ReadContainer(meshes, d.numMehes);
+    if (settings.deduplicate) {
+      ectx = &dedup.emplace(ectx);
+    }
+  }
 
-      std::vector<DynFile> phys;
-      rd.ReadContainer(phys, d.numPhys);
+  const AssetFilter filter(settings.includeTypes, settings.excludeTypes);
 
-      // No idea about order
-      std::vector<DynFile> flashes;
-      rd.ReadContainer(flashes, d.numFlashes);
+  // Megapacks are mapped once, stored entries are sent as views of mappings.
+  // Every worker reads them through its own streams
+  std::deque<SharedMapping> mappings;
 
-      std::vector<DynFile> textures;
-      rd.ReadContainer(textures, d.numTextures);
+  for (auto &m : megapacks) {
+    mappings.emplace_back(m.stream.path.string());
+  }
 
-      for (auto &df : meshes) {
-        auto mName = ExtractMeshPack(rd, curPath, ectx, inBuffer, outBuffer);
-        hash::GetStringHash(df.hash0, mName);
-      }
+  struct PackReaders {
+    std::vector<std::unique_ptr<std::istream>> megapacks;
+    std::string inBuffer;
+    std::string outBuffer;
+  };
 
-      for (auto &df : phys) {
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".phy");
-        Extract(ectx, df.size, df.uncompressedSize, inBuffer, outBuffer, rd);
-      }
+  std::vector<PackReaders> readers(
+      settings.parallel ? NumParallelWorkers(dynpacks.size()) : 1);
 
-      for (auto &df : flashes) {
-        rd.ReadContainer(inBuffer, df.size);
+  for (auto &r : readers) {
+    for (auto &m : mappings) {
+      r.megapacks.emplace_back(m.NewStream());
+    }
+  }
 
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".swf");
-        ectx->SendData(inBuffer);
-      }
+  // With namesOnly, mesh names are registered without extracting anything
+  auto ExtractFromPacks = [&](BinReaderRef_e rd, const GlobalPackDesc &d,
+                              AppExtractContext *ectx, PackReaders &r,
+                              bool namesOnly) {
+    const DynamicPackTables tables = ReadDynamicPackTables(rd, d);
 
-      for (auto &df : textures) {
-        if (!df.size) {
-          continue;
-        }
+    if (plan) {
+      PlanDynamicPack(rd, tables, d.name, *plan, filter);
+      return;
+    }
 
-        rd.ReadContainer(inBuffer, df.size);
+    ExtractDynamicPack(rd, tables, d.name + '/', ectx, r.inBuffer,
+                       r.outBuffer, filter, namesOnly);
+  };
 
-        ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
-                      ".dtex");
-        ectx->SendData(dtex);
-        ectx->SendData(inBuffer);
-      }
-    };
+  std::optional<ExtractManifest> manifest;
+
+  if (settings.incremental && !plan) {
+    manifest.emplace(output, workFolder + "global/",
+                     std::string(GlobalExtract_VERSION) + ' ' +
+                         settings.includeTypes + ':' + settings.excludeTypes +
+                         (dedup ? " d" : ""),
+                     dedup ? &*dedup : nullptr);
+  }
+
+  auto ArchiveName = [&](const std::filesystem::path &path) {
+    return std::filesystem::relative(path, workFolder).generic_string();
+  };
+
+  // With incremental setting, unchanged packs only register mesh names
+  auto ExtractSource = [&](BinReaderRef_e rd, const std::string &archive,
+                           uint64 size, const GlobalPackDesc &d,
+                           AppExtractContext *ectx, PackReaders &r,
+                           bool namesOnly) {
+    if (namesOnly || !manifest) {
+      ExtractFromPacks(rd, d, ectx, r, namesOnly);
+      return;
+    }
+
+    const ManifestSource source =
+        MakeManifestSource(rd, archive, size, r.inBuffer);
 
-    bool found_ = false;
+    if (manifest->Unchanged(source)) {
+      ExtractFromPacks(rd, d, ectx, r, true);
+      return;
+    }
+
+    ManifestExtractContext mctx(ectx);
+    ExtractFromPacks(rd, d, &mctx, r, false);
+    manifest->Add(source, std::move(mctx.outputs));
+  };
+
+  auto ExtractPack = [&](const GlobalPackDesc &d, AppExtractContext *ectx,
+                         PackReaders &r, bool namesOnly) {
+    for (size_t m = 0; m < megapacks.size(); m++) {
+      auto &files = megapacks[m].files;
 
-    for (auto &m : megapacks) {
-      if (auto found = m.files.find(d.assetIndex); !es::IsEnd(m.files, found)) {
+      if (auto found = files.find(d.assetIndex); !es::IsEnd(files, found)) {
         found->second.used = true;
-        m.rd.Seek(found->second.offset);
-        ExtractFromPacks(m.rd);
-        found_ = true;
-        break;
+        BinReaderRef_e rd(*r.megapacks[m]);
+        rd.Seek(found->second.offset);
+        ExtractSource(rd, ArchiveName(megapacks[m].stream.path),
+                      found->second.size, d, ectx, r, namesOnly);
+        return;
       }
     }
 
-    if (!found_)
-      try {
-        auto stream = ctx->FindFile(workFolder, d.name + ".pack");
-        ExtractFromPacks(*stream.Get());
-        found_ = true;
-      } catch (const es::FileNotFoundError &) {
-      }
+    if (auto path = install.Find(d.name + ".pack")) {
+      std::ifstream stream(*path, std::ios::binary);
+      ExtractSource(stream, ArchiveName(*path),
+                    std::filesystem::file_size(*path), d, ectx, r, namesOnly);
+      return;
+    }
 
-    if (!found_) {
+    if (plan) {
+      plan->Missing(d.name);
+    } else if (!namesOnly) {
       printerror("Couldn't find: ["
                  << std::to_string(hash::GetStringHash(d.assetIndex)) << "] "
                  << d.name);
     }
+  };
+
+  if (settings.parallel && !plan) {
+    // Register all mesh names first, so names of other assets don't depend
+    // on order in which packs are finished
+    RunParallel(dynpacks.size(), [&](size_t i, size_t w) {
+      ExtractPack(dynpacks[i], nullptr, readers[w], true);
+    });
+
+    std::mutex ectxMutex;
+
+    RunParallel(dynpacks.size(), [&](size_t i, size_t w) {
+      BufferedExtractContext bctx(ectx);
+      ExtractPack(dynpacks[i], &bctx, readers[w], false);
+      bctx.Flush(ectxMutex);
+    });
+  } else {
+    for (auto &d : dynpacks) {
+      ExtractPack(d, ectx, readers.front(), false);
+    }
+  }
+
+  if (manifest) {
+    manifest->Save(ectx);
+  }
+
+  if (plan) {
+    plan->Print();
+  }
+
+  if (dedup) {
+    dedup->Finish();
   }
 
   for (auto &m : megapacks) {
@@ -0,0 +1,575 @@
+/*  HeightmapExtract
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "francemap.hpp"
+#include "hashstorage.hpp"
+#include "installindex.hpp"
+#include "megapack.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include "spike/master_printer.hpp"
+#include "spike/reflect/reflector.hpp"
+#include "tilepack.hpp"
+#include "workpool.hpp"
+#include <cmath>
+#include <deque>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Need some anchor point, since loosefiles is stored all around
+std::string_view filters[]{
+    "*nimations.pack$",
+};
+
+struct HeightmapExtract : ReflectorBase<HeightmapExtract> {
+  bool pyramid = false;
+} settings;
+
+REFLECT(CLASS(HeightmapExtract),
+        MEMBER(pyramid, "p",
+               ReflDesc{"Also write downsampled levels into heightmap.hpyr "
+                        "for fast previews."}));
+
+static AppInfo_s appInfo{
+    .filteredLoad = true,
+    .header = HeightmapExtract_DESC " v" HeightmapExtract_VERSION
+                                    ", " HeightmapExtract_COPYRIGHT
+                                    "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
+    .filters = filters,
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+bool AppInitContext(const std::string &dataFolder) {
+  hash::LoadStorage(dataFolder + "saboteur_strings.txt");
+  return true;
+}
+
+struct Megapack {
+  InstallFileStream stream;
+  BinReaderRef_e rd;
+  std::map<uint32, FileRange> files;
+  std::mutex mutex;
+
+  Megapack(InstallFileStream &&stream_)
+      : stream(std::move(stream_)), rd(*stream.Get()),
+        files(LoadMegaPack(rd)) {}
+};
+
+struct HeightTile {
+  const Tile *tile;
+  Megapack *pack;
+  uint32 dataOffset;
+  HeightHeader hdr;
+};
+
+static bool ReadHeightHeader(BinReaderRef_e rd, HeightTile &item) {
+  rd.SwapEndian(false);
+  uint32 id;
+  rd.Read(id);
+
+  if (id != SBLA_ID) {
+    if (id == SBLA_ID_BE) {
+      rd.SwapEndian(true);
+    } else {
+      return false;
+    }
+  }
+
+  int32 metaSize;
+  rd.Read(metaSize);
+  rd.Read(item.hdr);
+  item.dataOffset = rd.Tell();
+
+  return item.hdr.id == HEI1_ID;
+}
+
+static void LoadHeightTile(const HeightTile &h, std::string &tile) {
+  std::string raw;
+  {
+    std::lock_guard lg(h.pack->mutex);
+    h.pack->rd.Seek(h.dataOffset);
+    h.pack->rd.ReadContainer(raw, h.hdr.numWBlocks * h.hdr.numHBlocks);
+  }
+
+  tile.resize(raw.size() * sizeof(uint16));
+  uint16 *pixels = reinterpret_cast<uint16 *>(tile.data());
+
+  for (size_t p = 0; p < raw.size(); p++) {
+    pixels[p] = uint8(raw[p]) * 257;
+  }
+}
+
+// Averages 2x2 blocks of two input rows into one output row
+static void Downsample2x2(const uint16 *row0, const uint16 *row1, uint16 *out,
+                          size_t outWidth) {
+  size_t x = 0;
+#ifdef __SSE2__
+  const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+  const __m128i rounding = _mm_set1_epi32(2);
+
+  auto PairSums = [&](const uint16 *row) {
+    __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row));
+    return _mm_add_epi32(_mm_and_si128(pixels, lowMask),
+                         _mm_srli_epi32(pixels, 16));
+  };
+
+  // Narrow to 16 bits without saturation, packs_epi32 is signed
+  auto Narrow = [](__m128i sums) {
+    return _mm_srai_epi32(_mm_slli_epi32(sums, 16), 16);
+  };
+
+  for (; x + 8 <= outWidth; x += 8) {
+    const uint16 *in0 = row0 + x * 2;
+    const uint16 *in1 = row1 + x * 2;
+    __m128i sum0 = _mm_add_epi32(PairSums(in0), PairSums(in1));
+    __m128i sum1 = _mm_add_epi32(PairSums(in0 + 8), PairSums(in1 + 8));
+    sum0 = _mm_srli_epi32(_mm_add_epi32(sum0, rounding), 2);
+    sum1 = _mm_srli_epi32(_mm_add_epi32(sum1, rounding), 2);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                     _mm_packs_epi32(Narrow(sum0), Narrow(sum1)));
+  }
+#endif
+
+  for (; x < outWidth; x++) {
+    const uint32 sum = row0[x * 2] + row0[x * 2 + 1] + row1[x * 2] +
+                       row1[x * 2 + 1];
+    out[x] = (sum + 2) / 4;
+  }
+}
+
+// Uncompressed, little endian, 16 bit, tiled GeoTIFF
+// Every game tile is stored as a single TIFF tile, missing tiles point to a
+// shared zero tile. Tile offsets are known upfront, so file can be streamed.
+struct TiffLayout {
+  std::string head;
+  std::string zeroTile;
+  size_t tileBytes;
+
+  template <class T> void Append(T value) {
+    head.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void Entry(uint16 tag, uint16 type, uint32 count, uint32 value) {
+    Append(tag);
+    Append(type);
+    Append(count);
+    Append(value);
+  }
+
+  TiffLayout(uint32 tileWidth, uint32 tileHeight, uint32 columns, uint32 rows,
+             const double (&pixelScale)[3], const double (&tiePoint)[6],
+             const std::vector<int32> &cells) {
+    static constexpr uint16 SHORT = 3;
+    static constexpr uint16 LONG = 4;
+    static constexpr uint16 DOUBLE = 12;
+    static constexpr uint16 NUM_ENTRIES = 15;
+    static constexpr uint16 GEO_KEYS[]{
+        1,    1, 0, 2,     // version, number of keys
+        1024, 0, 1, 32767, // GTModelTypeGeoKey, user defined
+        1025, 0, 1, 1,     // GTRasterTypeGeoKey, PixelIsArea
+    };
+
+    tileBytes = tileWidth * tileHeight * sizeof(uint16);
+    const uint32 numTiles = cells.size();
+    const uint32 ifdOffset = 8;
+    const uint32 offsetsOffset = ifdOffset + 2 + NUM_ENTRIES * 12 + 4;
+    const uint32 countsOffset = offsetsOffset + numTiles * 4;
+    const uint32 scaleOffset = countsOffset + numTiles * 4;
+    const uint32 tieOffset = scaleOffset + sizeof(pixelScale);
+    const uint32 keysOffset = tieOffset + sizeof(tiePoint);
+    const uint32 zeroTileOffset = keysOffset + sizeof(GEO_KEYS);
+    const uint32 imageWidth = tileWidth * columns;
+    const uint32 imageHeight = tileHeight * rows;
+
+    head.append("II");
+    Append(uint16(42));
+    Append(ifdOffset);
+    Append(NUM_ENTRIES);
+    Entry(256, LONG, 1, imageWidth);
+    Entry(257, LONG, 1, imageHeight);
+    Entry(258, SHORT, 1, 16); // BitsPerSample
+    Entry(259, SHORT, 1, 1);  // Compression, none
+    Entry(262, SHORT, 1, 1);  // Photometric, BlackIsZero
+    Entry(277, SHORT, 1, 1);  // SamplesPerPixel
+    Entry(284, SHORT, 1, 1);  // PlanarConfiguration, contiguous
+    Entry(322, LONG, 1, tileWidth);
+    Entry(323, LONG, 1, tileHeight);
+    Entry(324, LONG, numTiles, offsetsOffset);
+    Entry(325, LONG, numTiles, countsOffset);
+    Entry(339, SHORT, 1, 1); // SampleFormat, unsigned
+    Entry(33550, DOUBLE, 3, scaleOffset);
+    Entry(33922, DOUBLE, 6, tieOffset);
+    Entry(34735, SHORT, std::size(GEO_KEYS), keysOffset);
+    Append(uint32(0));
+
+    uint32 nextTileOffset = zeroTileOffset + tileBytes;
+
+    for (int32 c : cells) {
+      if (c < 0) {
+        Append(zeroTileOffset);
+      } else {
+        Append(nextTileOffset);
+        nextTileOffset += tileBytes;
+      }
+    }
+
+    for (size_t t = 0; t < numTiles; t++) {
+      Append(uint32(tileBytes));
+    }
+
+    for (double s : pixelScale) {
+      Append(s);
+    }
+
+    for (double t : tiePoint) {
+      Append(t);
+    }
+
+    for (uint16 k : GEO_KEYS) {
+      Append(k);
+    }
+
+    zeroTile.resize(tileBytes);
+  }
+};
+
+/*
+HPYR container, little endian
+  char id[4]; // HPYR
+  uint32 version;
+  uint32 tileWidth;
+  uint32 tileHeight;
+  uint32 numLevels;
+  double pixelScale[2]; // level 0, doubles each level
+  double origin[2]; // x, z of top left corner
+  struct {
+    uint32 columns;
+    uint32 rows;
+  } levels[numLevels];
+  uint64 tileOffsets[]; // per level, row major, 0 for empty tiles
+  uint16 tiles[][tileHeight][tileWidth];
+
+Level 0 is full resolution, every next level halves it, last level is a
+single tile. Tiles are stored children first, so parents can be built with
+only one branch of the quad tree in memory.
+*/
+struct HeightPyramid {
+  struct Level {
+    uint32 columns;
+    uint32 rows;
+    std::vector<bool> present;
+    std::vector<uint64> offsets;
+  };
+
+  uint32 tileWidth;
+  uint32 tileHeight;
+  size_t tileBytes;
+  const std::vector<int32> &cells;
+  std::vector<Level> levels;
+
+  HeightPyramid(uint32 tileWidth_, uint32 tileHeight_, uint32 columns,
+                uint32 rows, const std::vector<int32> &cells_)
+      : tileWidth(tileWidth_), tileHeight(tileHeight_),
+        tileBytes(tileWidth_ * tileHeight_ * sizeof(uint16)), cells(cells_) {
+    Level &base = levels.emplace_back(Level{columns, rows, {}, {}});
+
+    for (int32 c : cells) {
+      base.present.push_back(c >= 0);
+    }
+
+    while (levels.back().columns > 1 || levels.back().rows > 1) {
+      const Level &child = levels.back();
+      Level parent{(child.columns + 1) / 2, (child.rows + 1) / 2, {}, {}};
+      parent.present.resize(parent.columns * parent.rows);
+
+      for (uint32 y = 0; y < child.rows; y++) {
+        for (uint32 x = 0; x < child.columns; x++) {
+          if (child.present[y * child.columns + x]) {
+            parent.present[(y / 2) * parent.columns + x / 2] = true;
+          }
+        }
+      }
+
+      levels.emplace_back(std::move(parent));
+    }
+  }
+
+  template <class Func> void Visit(size_t level, uint32 x, uint32 y, Func &&f) {
+    const Level &l = levels.at(level);
+
+    if (x >= l.columns || y >= l.rows || !l.present[y * l.columns + x]) {
+      return;
+    }
+
+    if (level > 0) {
+      for (uint32 c = 0; c < 4; c++) {
+        Visit(level - 1, x * 2 + (c & 1), y * 2 + (c >> 1), f);
+      }
+    }
+
+    f(level, x, y);
+  }
+
+  std::string Header(const double (&pixelScale)[3],
+                     const double (&tiePoint)[6]) {
+    std::string retVal;
+    auto Append = [&](auto value) {
+      retVal.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+
+    size_t numTiles = 0;
+
+    for (auto &l : levels) {
+      numTiles += l.present.size();
+    }
+
+    const size_t headerSize = 20 + 4 * sizeof(double) + levels.size() * 8 +
+                              numTiles * sizeof(uint64);
+    uint64 nextOffset = headerSize;
+
+    for (auto &l : levels) {
+      l.offsets.resize(l.present.size());
+    }
+
+    Visit(levels.size() - 1, 0, 0, [&](size_t level, uint32 x, uint32 y) {
+      Level &l = levels[level];
+      l.offsets[y * l.columns + x] = nextOffset;
+      nextOffset += tileBytes;
+    });
+
+    retVal.append("HPYR");
+    Append(uint32(1));
+    Append(tileWidth);
+    Append(tileHeight);
+    Append(uint32(levels.size()));
+    Append(pixelScale[0]);
+    Append(pixelScale[1]);
+    Append(tiePoint[3]);
+    Append(tiePoint[4]);
+
+    for (auto &l : levels) {
+      Append(l.columns);
+      Append(l.rows);
+    }
+
+    for (auto &l : levels) {
+      retVal.append(reinterpret_cast<const char *>(l.offsets.data()),
+                    l.offsets.size() * sizeof(uint64));
+    }
+
+    return retVal;
+  }
+
+  template <class LoadFunc>
+  void Build(AppExtractContext *ectx, LoadFunc &&loadTile) {
+    // Parents under construction, at most one per level
+    std::vector<std::string> parents(levels.size());
+    std::string tile;
+
+    Visit(levels.size() - 1, 0, 0, [&](size_t level, uint32 x, uint32 y) {
+      if (level == 0) {
+        loadTile(cells.at(y * levels[0].columns + x), tile);
+      } else {
+        tile = std::move(parents[level]);
+        parents[level].clear();
+      }
+
+      ectx->SendData(tile);
+
+      // Parent tile is assembled in place from its children quadrants
+      if (level + 1 < levels.size()) {
+        std::string &parent = parents[level + 1];
+
+        if (parent.empty()) {
+          parent.resize(tileBytes);
+        }
+
+        const uint16 *src = reinterpret_cast<const uint16 *>(tile.data());
+        uint16 *dst = reinterpret_cast<uint16 *>(parent.data());
+        dst += (y & 1) * (tileHeight / 2) * tileWidth + (x & 1) * tileWidth / 2;
+
+        for (uint32 row = 0; row < tileHeight / 2; row++) {
+          Downsample2x2(src + row * 2 * tileWidth,
+                        src + (row * 2 + 1) * tileWidth, dst + row * tileWidth,
+                        tileWidth / 2);
+        }
+      }
+    });
+  }
+};
+
+void AppProcessFile(AppContext *ctx) {
+  std::string workFolder(ctx->workingFile.GetFolder());
+  const InstallIndex install(workFolder);
+  FranceMapItems franceMap = FindFranceMap(install);
+
+  if (franceMap.tiles.empty()) {
+    throw std::runtime_error("france.map not found");
+  }
+
+  std::deque<Megapack> megapacks;
+
+  for (auto name : {"mega0.megapack", "mega1.megapack", "mega2.megapack"}) {
+    try {
+      megapacks.emplace_back(install.Open(name));
+    } catch (const es::FileNotFoundError &) {
+    }
+  }
+
+  std::vector<HeightTile> heightTiles;
+
+  for (auto &t : franceMap.tiles) {
+    for (auto &m : megapacks) {
+      if (auto found = m.files.find(t.hash); !es::IsEnd(m.files, found)) {
+        HeightTile item{};
+        item.tile = &t;
+        item.pack = &m;
+        m.rd.Seek(found->second.offset);
+
+        if (ReadHeightHeader(m.rd, item)) {
+          heightTiles.emplace_back(item);
+        }
+
+        break;
+      }
+    }
+  }
+
+  if (heightTiles.empty()) {
+    throw std::runtime_error("No height data found");
+  }
+
+  // Grid cell is the smallest tile, coarser LOD tiles are skipped
+  float cellWidth = INFINITY;
+  float cellHeight = INFINITY;
+
+  for (auto &h : heightTiles) {
+    const float *b = h.tile->bounds;
+    cellWidth = std::min(cellWidth, b[3] - b[0]);
+    cellHeight = std::min(cellHeight, b[5] - b[2]);
+  }
+
+  std::erase_if(heightTiles, [&](const HeightTile &h) {
+    const float *b = h.tile->bounds;
+    return std::abs(b[3] - b[0] - cellWidth) > cellWidth / 100 ||
+           std::abs(b[5] - b[2] - cellHeight) > cellHeight / 100;
+  });
+
+  const uint32 tileWidth = heightTiles.front().hdr.numWBlocks;
+  const uint32 tileHeight = heightTiles.front().hdr.numHBlocks;
+
+  if (tileWidth % 16 || tileHeight % 16) {
+    throw std::runtime_error("Height tile size is not multiple of 16");
+  }
+
+  std::erase_if(heightTiles, [&](const HeightTile &h) {
+    if (h.hdr.numWBlocks == tileWidth && h.hdr.numHBlocks == tileHeight) {
+      return false;
+    }
+
+    PrintWarning("Skipping tile ",
+                 std::to_string(hash::GetStringHash(h.tile->hash)),
+                 ", unexpected size");
+    return true;
+  });
+
+  float minX = INFINITY;
+  float maxX = -INFINITY;
+  float minZ = INFINITY;
+  float maxZ = -INFINITY;
+
+  for (auto &h : heightTiles) {
+    const float *b = h.tile->bounds;
+    minX = std::min(minX, b[0]);
+    maxX = std::max(maxX, b[3]);
+    minZ = std::min(minZ, b[2]);
+    maxZ = std::max(maxZ, b[5]);
+  }
+
+  const uint32 columns = std::lround((maxX - minX) / cellWidth);
+  const uint32 rows = std::lround((maxZ - minZ) / cellHeight);
+  std::vector<int32> cells(columns * rows, -1);
+
+  for (size_t i = 0; i < heightTiles.size(); i++) {
+    const float *b = heightTiles[i].tile->bounds;
+    const size_t column = std::lround((b[0] - minX) / cellWidth);
+    const size_t row = std::lround((maxZ - b[5]) / cellHeight);
+    int32 &cell = cells.at(row * columns + column);
+
+    if (cell >= 0) {
+      PrintWarning("Skipping tile ",
+                   std::to_string(hash::GetStringHash(
+                       heightTiles[i].tile->hash)),
+                   ", cell already occupied");
+      continue;
+    }
+
+    cell = i;
+  }
+
+  std::vector<const HeightTile *> orderedTiles;
+
+  for (int32 c : cells) {
+    if (c >= 0) {
+      orderedTiles.emplace_back(&heightTiles[c]);
+    }
+  }
+
+  const double pixelScale[3]{cellWidth / tileWidth, cellHeight / tileHeight,
+                             0};
+  const double tiePoint[6]{0, 0, 0, minX, maxZ, 0};
+  TiffLayout layout(tileWidth, tileHeight, columns, rows, pixelScale,
+                    tiePoint, cells);
+
+  auto ectx = ctx->ExtractContext("heightmap");
+  ectx->NewFile("heightmap.tif");
+  ectx->SendData(layout.head);
+  ectx->SendData(layout.zeroTile);
+
+  // Tiles are handed out in file order, so only a few finished tiles wait
+  // for their turn
+  std::vector<std::string> tiles(orderedTiles.size());
+
+  RunParallelOrdered(
+      orderedTiles.size(),
+      [&](size_t i) { LoadHeightTile(*orderedTiles[i], tiles[i]); },
+      [&](size_t i) {
+        ectx->SendData(tiles[i]);
+        std::string().swap(tiles[i]);
+      });
+
+  PrintInfo("Stitched ", orderedTiles.size(), " tiles into ", columns, "x",
+            rows, " grid");
+
+  if (settings.pyramid) {
+    HeightPyramid pyramid(tileWidth, tileHeight, columns, rows, cells);
+    ectx->NewFile("heightmap.hpyr");
+    ectx->SendData(pyramid.Header(pixelScale, tiePoint));
+    pyramid.Build(ectx, [&](size_t cell, std::string &tile) {
+      LoadHeightTile(heightTiles.at(cell), tile);
+    });
+
+    PrintInfo("Written ", pyramid.levels.size(), " pyramid levels");
+  }
+}
@@ -0,0 +1,334 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/except.hpp"
+#include "spike/io/stat.hpp"
+#include "spike/util/supercore.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static constexpr uint32 CATL_ID = CompileFourCC("CATL");
+static constexpr uint32 CATL_VERSION = 4;
+static constexpr uint32 CATALOG_NONE = ~0U;
+
+enum class CatalogType : uint8 {
+  Data, // megapack entry of unknown type
+  TilePack,
+  Mesh,
+  Phys,
+  Layout,
+  FB,
+  PV,
+  Mask,
+  Texture,
+  LooseFile,
+  Cinematic,
+  Lua,
+  Animations,
+  DynamicPack, // megapack entry, unpacked by global or france modules
+  Flash,
+};
+
+static constexpr std::string_view CATALOG_TYPE_NAMES[]{
+    "data",  "tilepack", "mesh",      "phys", "layout",     "fb",
+    "pv",    "mask",     "texture",   "loose", "cinematic", "lua",
+    "animations", "dynamic", "flash",
+};
+
+// Type lists are separated by spaces or commas, empty list gives every type
+inline uint32 CatalogTypeMask(std::string_view list) {
+  uint32 retVal = 0;
+
+  while (!list.empty()) {
+    const size_t nameEnd = list.find_first_of(" ,");
+    std::string_view name = list.substr(0, nameEnd);
+    list.remove_prefix(nameEnd == list.npos ? list.size() : nameEnd + 1);
+
+    if (name.empty()) {
+      continue;
+    }
+
+    auto found = std::find(std::begin(CATALOG_TYPE_NAMES),
+                           std::end(CATALOG_TYPE_NAMES), name);
+
+    if (found == std::end(CATALOG_TYPE_NAMES)) {
+      throw std::runtime_error("Unknown asset type: " + std::string(name));
+    }
+
+    retVal |= 1 << std::distance(std::begin(CATALOG_TYPE_NAMES), found);
+  }
+
+  return retVal ? retVal : ~0U;
+}
+
+struct CatalogRecord {
+  uint32 hash;
+  uint32 name; // string table offset
+  // Absolute offset in archive file, including offsets of containers
+  uint64 offset;
+  uint32 compressedSize;
+  uint32 uncompressedSize;
+  // Record index of containing asset (tile pack, loose file) or CATALOG_NONE
+  uint32 container;
+  uint16 archive;
+  CatalogType type;
+  uint8 null = 0;
+};
+
+static_assert(sizeof(CatalogRecord) == 32);
+
+/*
+Catalog file, little endian, all tables are used directly from mapped file
+  CatalogHeader header;
+  uint32 archives[numArchives]; // string table offsets of archive paths
+  pad to 8 bytes
+  CatalogRecord records[numRecords]; // sorted by hash
+  uint32 buckets[numBuckets]; // first record of hash, linear probing
+  char strings[stringsSize]; // null terminated
+*/
+struct CatalogHeader {
+  uint32 id = CATL_ID;
+  uint32 version = CATL_VERSION;
+  uint32 numArchives;
+  uint32 numRecords;
+  uint32 numBuckets; // power of 2
+  uint32 stringsSize;
+};
+
+inline uint32 CatalogBucket(uint32 hash, uint32 numBuckets) {
+  return uint32((hash * 0x9E3779B97F4A7C15ULL) >> 32) & (numBuckets - 1);
+}
+
+// Collects records of scanned archives and writes catalog file
+struct AssetCatalogBuilder {
+  uint16 AddArchive(std::string_view path) {
+    archives.emplace_back(AddString(path));
+    return archives.size() - 1;
+  }
+
+  // Returns index for container of other records
+  uint32 Add(CatalogRecord record, std::string_view name) {
+    record.name = AddString(name);
+    records.emplace_back(record);
+    return records.size() - 1;
+  }
+
+  size_t NumRecords() const { return records.size(); }
+
+  std::string Save() const {
+    std::vector<uint32> order(records.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32 a, uint32 b) {
+      return records[a].hash < records[b].hash;
+    });
+
+    std::vector<uint32> newIndex(records.size());
+
+    for (uint32 i = 0; i < order.size(); i++) {
+      newIndex[order[i]] = i;
+    }
+
+    std::vector<CatalogRecord> sorted;
+    sorted.reserve(records.size());
+
+    for (uint32 i : order) {
+      CatalogRecord &rec = sorted.emplace_back(records[i]);
+
+      if (rec.container != CATALOG_NONE) {
+        rec.container = newIndex.at(rec.container);
+      }
+    }
+
+    uint32 numBuckets = 16;
+
+    while (numBuckets < sorted.size() * 2) {
+      numBuckets *= 2;
+    }
+
+    std::vector<uint32> buckets(numBuckets, CATALOG_NONE);
+
+    for (uint32 i = 0; i < sorted.size(); i++) {
+      if (i && sorted[i - 1].hash == sorted[i].hash) {
+        continue;
+      }
+
+      uint32 b = CatalogBucket(sorted[i].hash, numBuckets);
+
+      while (buckets[b] != CATALOG_NONE) {
+        b = (b + 1) & (numBuckets - 1);
+      }
+
+      buckets[b] = i;
+    }
+
+    CatalogHeader hdr;
+    hdr.numArchives = archives.size();
+    hdr.numRecords = sorted.size();
+    hdr.numBuckets = numBuckets;
+    hdr.stringsSize = strings.size();
+
+    std::string retVal(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    retVal.append(reinterpret_cast<const char *>(archives.data()),
+                  archives.size() * sizeof(uint32));
+    retVal.resize((retVal.size() + 7) & ~size_t(7));
+    retVal.append(reinterpret_cast<const char *>(sorted.data()),
+                  sorted.size() * sizeof(CatalogRecord));
+    retVal.append(reinterpret_cast<const char *>(buckets.data()),
+                  buckets.size() * sizeof(uint32));
+    retVal.append(strings);
+
+    return retVal;
+  }
+
+private:
+  uint32 AddString(std::string_view str) {
+    auto found = stringOffsets.find(str);
+
+    if (!es::IsEnd(stringOffsets, found)) {
+      return found->second;
+    }
+
+    const uint32 offset = strings.size();
+    strings.append(str).push_back(0);
+    stringOffsets.emplace(str, offset);
+
+    return offset;
+  }
+
+  std::vector<uint32> archives;
+  std::vector<CatalogRecord> records;
+  std::string strings;
+  std::map<std::string, uint32, std::less<>> stringOffsets;
+};
+
+// Memory mapped catalog, lookups by hash are O(1), type and name queries
+// walk records
+struct AssetCatalog {
+  AssetCatalog(const std::string &path) : mappedFile(path) {
+    Load({static_cast<const char *>(mappedFile.data), mappedFile.fileSize},
+         path);
+  }
+
+  // Catalog is kept in memory, without writing catalog file
+  AssetCatalog(const AssetCatalogBuilder &builder) : buffer(builder.Save()) {
+    Load(buffer, "memory");
+  }
+
+  AssetCatalog(const AssetCatalog &) = delete;
+
+  std::span<const CatalogRecord> Records() const { return records; }
+
+  // All records of hash, same asset can be stored in more archives
+  std::span<const CatalogRecord> Find(uint32 hash) const {
+    for (uint32 b = CatalogBucket(hash, hdr.numBuckets);
+         buckets[b] != CATALOG_NONE; b = (b + 1) & (hdr.numBuckets - 1)) {
+      const uint32 first = buckets[b];
+
+      if (records[first].hash == hash) {
+        uint32 last = first;
+
+        while (last < records.size() && records[last].hash == hash) {
+          last++;
+        }
+
+        return records.subspan(first, last - first);
+      }
+    }
+
+    return {};
+  }
+
+  // typeMask from CatalogTypeMask, records whose name contains namePart
+  template <class Func>
+  void Query(uint32 typeMask, std::string_view namePart, Func &&func) const {
+    for (auto &r : records) {
+      if ((typeMask >> uint8(r.type) & 1) &&
+          (namePart.empty() || Name(r).find(namePart) != namePart.npos)) {
+        func(r);
+      }
+    }
+  }
+
+  std::string_view Name(const CatalogRecord &record) const {
+    return strings.data() + record.name;
+  }
+
+  size_t NumArchives() const { return hdr.numArchives; }
+
+  std::string_view Archive(uint16 archive) const {
+    return strings.data() + archives[archive];
+  }
+
+  std::string_view Archive(const CatalogRecord &record) const {
+    return Archive(record.archive);
+  }
+
+  const CatalogRecord *Container(const CatalogRecord &record) const {
+    return record.container == CATALOG_NONE ? nullptr
+                                            : &records[record.container];
+  }
+
+private:
+  void Load(std::string_view data, const std::string &path) {
+    if (data.size() < sizeof(CatalogHeader)) {
+      throw std::runtime_error("Truncated catalog: " + path);
+    }
+
+    memcpy(&hdr, data.data(), sizeof(hdr));
+
+    if (hdr.id != CATL_ID) {
+      throw es::InvalidHeaderError(hdr.id);
+    }
+
+    if (hdr.version != CATL_VERSION) {
+      throw std::runtime_error("Unsupported catalog version: " +
+                               std::to_string(hdr.version));
+    }
+
+    size_t offset = sizeof(hdr);
+    archives = reinterpret_cast<const uint32 *>(data.data() + offset);
+    offset += hdr.numArchives * sizeof(uint32);
+    offset = (offset + 7) & ~size_t(7);
+    records = {reinterpret_cast<const CatalogRecord *>(data.data() + offset),
+               hdr.numRecords};
+    offset += hdr.numRecords * sizeof(CatalogRecord);
+    buckets = reinterpret_cast<const uint32 *>(data.data() + offset);
+    offset += hdr.numBuckets * sizeof(uint32);
+    strings = {data.data() + offset, hdr.stringsSize};
+
+    if (offset + hdr.stringsSize > data.size()) {
+      throw std::runtime_error("Truncated catalog: " + path);
+    }
+  }
+
+  es::MappedFile mappedFile;
+  std::string buffer;
+  CatalogHeader hdr;
+  const uint32 *archives;
+  std::span<const CatalogRecord> records;
+  const uint32 *buckets;
+  std::string_view strings;
+};
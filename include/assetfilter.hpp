@@ -0,0 +1,85 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/util/supercore.hpp"
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+enum class AssetType : uint8 {
+  Mesh,
+  Phys,
+  Layout,
+  FB,
+  PV,
+  Flash,
+  Texture,
+  Mask,
+};
+
+static constexpr std::string_view ASSET_TYPE_NAMES[]{
+    "mesh", "phys", "layout", "fb", "pv", "flash", "texture", "mask",
+};
+
+// Type lists are separated by spaces or commas, for example "mesh,texture".
+// Empty include list accepts every type.
+struct AssetFilter {
+  uint32 accepted = ~0U;
+
+  AssetFilter() = default;
+  AssetFilter(const std::string &include, const std::string &exclude) {
+    if (!include.empty()) {
+      accepted = ParseTypes(include);
+    }
+
+    accepted &= ~ParseTypes(exclude);
+  }
+
+  bool Accepts(AssetType type) const { return accepted >> uint8(type) & 1; }
+
+private:
+  static uint32 ParseTypes(std::string_view list) {
+    uint32 retVal = 0;
+
+    while (!list.empty()) {
+      const size_t nameEnd = list.find_first_of(" ,");
+      std::string_view name = list.substr(0, nameEnd);
+      list.remove_prefix(nameEnd == list.npos ? list.size() : nameEnd + 1);
+
+      if (name.empty()) {
+        continue;
+      }
+
+      bool found = false;
+
+      for (uint32 t = 0; t < std::size(ASSET_TYPE_NAMES); t++) {
+        if (ASSET_TYPE_NAMES[t] == name) {
+          retVal |= 1 << t;
+          found = true;
+        }
+      }
+
+      if (!found) {
+        throw std::runtime_error("Unknown asset type: " + std::string(name));
+      }
+    }
+
+    return retVal;
+  }
+};
@@ -0,0 +1,79 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/except.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// Cinematic entry of cinematics.cinpack, offset is relative to cinpack start
+struct Cinematic {
+  uint32 offset;
+  uint32 size = 0;
+  mutable bool used = false;
+};
+
+// Reads table at current position, endOffset is size of whole cinpack.
+// Entry sizes are derived from offset of next entry.
+inline std::map<uint32, Cinematic> LoadCinpack(BinReaderRef_e rd,
+                                               size_t endOffset) {
+  uint32 id;
+  rd.Read(id);
+  if (id != 0xC) {
+    if (id == 0xC000000) {
+      rd.SwapEndian(true);
+    } else {
+      throw es::InvalidHeaderError(id);
+    }
+  }
+
+  uint32 numItems;
+  rd.Read(numItems);
+
+  std::map<uint32, Cinematic> items;
+  std::vector<uint32> offsets;
+
+  for (uint32 i = 0; i < numItems; i++) {
+    uint32 id;
+    uint32 offset;
+    bool unk;
+
+    rd.Read(id);
+    rd.Read(offset);
+    rd.Read(unk);
+
+    items.emplace(id, Cinematic{offset});
+    offsets.emplace_back(offset);
+  }
+
+  std::sort(offsets.begin(), offsets.end());
+
+  for (auto &[_, item] : items) {
+    auto nextOffset =
+        std::upper_bound(offsets.begin(), offsets.end(), item.offset);
+
+    if (es::IsEnd(offsets, nextOffset)) {
+      item.size = endOffset - item.offset;
+    } else {
+      item.size = *nextOffset - item.offset;
+    }
+  }
+
+  return items;
+}
@@ -16,20 +16,22 @@
 */
 
 #pragma once
+#include "memstream.hpp"
 #include "spike/app_context.hpp"
 #include "spike/io/binreader_stream.hpp"
 #include "zlib.h"
 
-void ExtractZlib(AppExtractContext *ectx, uint32 compSize, uint32 uncompSize,
-                 std::string &inData, std::string &outData,
-                 int32 wbits = MAX_WBITS) {
+// Output is trimmed, when stream inflates into less than uncompSize
+inline void Inflate(std::string_view inData, uint32 uncompSize,
+                    std::string &outData, int32 wbits = MAX_WBITS) {
   outData.resize(uncompSize);
   z_stream infstream;
   infstream.zalloc = Z_NULL;
   infstream.zfree = Z_NULL;
   infstream.opaque = Z_NULL;
-  infstream.avail_in = compSize;
-  infstream.next_in = reinterpret_cast<Bytef *>(&inData[0]);
+  infstream.avail_in = inData.size();
+  infstream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(inData.data()));
   infstream.avail_out = outData.size();
   infstream.next_out = reinterpret_cast<Bytef *>(&outData[0]);
   inflateInit2(&infstream, wbits);
@@ -43,10 +45,31 @@ void ExtractZlib(AppExtractContext *ectx, uint32 compSize, uint32 uncompSize,
   if (infstream.total_out < uncompSize) {
     outData.resize(infstream.total_out);
   }
+}
 
+void ExtractZlib(AppExtractContext *ectx, uint32 compSize, uint32 uncompSize,
+                 std::string &inData, std::string &outData,
+                 int32 wbits = MAX_WBITS) {
+  Inflate(std::string_view(inData.data(), compSize), uncompSize, outData,
+          wbits);
   ectx->SendData(outData);
 }
 
+// Inflates straight from memory backed stream, otherwise through inData
+inline void ExtractZlibChunk(AppExtractContext *ectx, uint32 compSize,
+                             uint32 uncompSize, std::string &inData,
+                             std::string &outData, BinReaderRef_e rd,
+                             int32 wbits = MAX_WBITS) {
+  if (auto view = ReadView(rd.BaseStream(), compSize)) {
+    Inflate(*view, uncompSize, outData, wbits);
+    ectx->SendData(outData);
+    return;
+  }
+
+  rd.ReadContainer(inData, compSize);
+  ExtractZlib(ectx, compSize, uncompSize, inData, outData, wbits);
+}
+
 struct SEGS {
   uint32 id;
   uint16 version;
@@ -93,9 +116,8 @@ void Extract(AppExtractContext *ectx, uint32 compSize, uint32 uncompSize,
       rd.Seek(c.offset - 1);
       uint32 uncompSize =
           c.uncompressedSize == 0 ? 0x10000 : c.uncompressedSize;
-      rd.ReadContainer(inData, c.compressedSize);
-      ExtractZlib(ectx, c.compressedSize, uncompSize, inData, outData,
-                  -MAX_WBITS);
+      ExtractZlibChunk(ectx, c.compressedSize, uncompSize, inData, outData,
+                       rd, -MAX_WBITS);
     }
 
     rd.ResetRelativeOrigin();
@@ -105,10 +127,16 @@ void Extract(AppExtractContext *ectx, uint32 compSize, uint32 uncompSize,
     return;
   }
 
-  rd.ReadContainer(inData, compSize);
-  if (compSize != uncompSize) {
-    ExtractZlib(ectx, compSize, uncompSize, inData, outData);
-  } else {
+  if (compSize == uncompSize) {
+    if (auto view = ReadView(rd.BaseStream(), compSize)) {
+      ectx->SendData(*view);
+      return;
+    }
+
+    rd.ReadContainer(inData, compSize);
     ectx->SendData(inData);
+    return;
   }
+
+  ExtractZlibChunk(ectx, compSize, uncompSize, inData, outData, rd);
 }
@@ -0,0 +1,199 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "fingerprint.hpp"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/master_printer.hpp"
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+// Holds every output until it's complete, then writes only first occurence of
+// any content. Duplicates are listed in dedup_manifest.txt as
+// <duplicate path>\t<stored path>
+// Contents are matched by size and SHA-1 digest, nothing is kept in memory
+// or on disk for comparison.
+// Duplicates of sources skipped by ExtractManifest are carried over by
+// KeepDuplicates.
+struct DedupExtractContext : AppExtractContext {
+  DedupExtractContext(AppExtractContext *base_) : base(base_) {}
+
+  void NewFile(const std::string &path) override {
+    Flush();
+    curFile = path;
+  }
+
+  void SendData(std::string_view data) override { curData.append(data); }
+
+  bool RequiresFolders() const override { return base->RequiresFolders(); }
+
+  void AddFolderPath(const std::string &path) override {
+    base->AddFolderPath(path);
+  }
+
+  void GenerateFolders() override { base->GenerateFolders(); }
+
+  // Duplicates of unchanged sources, that weren't extracted again.
+  // storedFolder is where stored paths exist on disk. Fails when any stored
+  // file was already written by this run, its content might differ now.
+  bool KeepDuplicates(
+      const std::vector<std::pair<std::string, std::string>> &dups,
+      const std::filesystem::path &storedFolder) {
+    std::lock_guard lg(keptMutex);
+
+    for (auto &[dup, stored] : dups) {
+      if (written.contains(stored)) {
+        return false;
+      }
+    }
+
+    for (auto &[dup, stored] : dups) {
+      KeptStored &k = kept[stored];
+      k.diskPath = (storedFolder / stored).string();
+      k.duplicates.emplace_back(dup);
+    }
+
+    return true;
+  }
+
+  void Finish() {
+    Flush();
+
+    for (auto &[stored, k] : kept) {
+      for (auto &dup : k.duplicates) {
+        duplicates.emplace_back(dup, stored);
+      }
+    }
+
+    std::string manifest;
+
+    for (auto &[dup, stored] : duplicates) {
+      manifest.append(dup).push_back('\t');
+      manifest.append(stored).push_back('\n');
+    }
+
+    // Written even when empty, manifest of last run might be stale
+    base->NewFile("dedup_manifest.txt");
+    base->SendData(manifest);
+
+    if (duplicates.empty()) {
+      return;
+    }
+
+    PrintInfo("Deduplicated ", duplicates.size(), " of ",
+              duplicates.size() + numStored, " files, saved ", savedBytes,
+              " of ", totalBytes, " bytes");
+  }
+
+private:
+  struct BlobKey {
+    hash::Digest digest;
+    size_t size;
+
+    bool operator<(const BlobKey &o) const {
+      return digest < o.digest || (digest == o.digest && size < o.size);
+    }
+  };
+
+  struct KeptStored {
+    std::string diskPath;
+    std::vector<std::string> duplicates;
+  };
+
+  // Stored file of kept duplicates is about to be written again. Duplicates
+  // stay mapped to it, when content didn't change, otherwise content from
+  // last run is restored into first duplicate.
+  void RestoreKept(std::vector<std::string> &dups, std::string_view lastData,
+                   const std::string &storedPath) {
+    if (lastData == curData) {
+      for (auto &d : dups) {
+        duplicates.emplace_back(std::move(d), storedPath);
+      }
+
+      return;
+    }
+
+    base->NewFile(dups.front());
+    base->SendData(lastData);
+    numStored++;
+
+    for (size_t i = 1; i < dups.size(); i++) {
+      duplicates.emplace_back(std::move(dups[i]), dups.front());
+    }
+  }
+
+  void Flush() {
+    if (curFile.empty()) {
+      return;
+    }
+
+    std::vector<std::string> keptDups;
+    std::string lastData;
+
+    {
+      std::lock_guard lg(keptMutex);
+      written.emplace(curFile);
+      auto found = kept.find(curFile);
+
+      // Read before base overwrites it
+      if (!es::IsEnd(kept, found)) {
+        keptDups = std::move(found->second.duplicates);
+        std::ifstream str(found->second.diskPath, std::ios::binary);
+        lastData.assign(std::istreambuf_iterator<char>(str), {});
+        kept.erase(found);
+      }
+    }
+
+    totalBytes += curData.size();
+    auto [stored, inserted] = blobs.try_emplace(
+        BlobKey{hash::StrongFingerprint(curData), curData.size()}, curFile);
+    const std::string storedPath = stored->second;
+
+    if (inserted) {
+      base->NewFile(curFile);
+      base->SendData(curData);
+      numStored++;
+    } else {
+      duplicates.emplace_back(std::move(curFile), storedPath);
+      savedBytes += curData.size();
+    }
+
+    if (!keptDups.empty()) {
+      RestoreKept(keptDups, lastData, storedPath);
+    }
+
+    curFile.clear();
+    curData.clear();
+  }
+
+  AppExtractContext *base;
+  std::string curFile;
+  std::string curData;
+  std::map<BlobKey, std::string> blobs;
+  std::vector<std::pair<std::string, std::string>> duplicates;
+  std::map<std::string, KeptStored> kept;
+  std::set<std::string> written;
+  std::mutex keptMutex;
+  size_t numStored = 0;
+  size_t savedBytes = 0;
+  size_t totalBytes = 0;
+};
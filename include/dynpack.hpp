@@ -0,0 +1,215 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "assetfilter.hpp"
+#include "extractplan.hpp"
+#include "francemap.hpp"
+#include "globalmap.hpp"
+#include "hashstorage.hpp"
+#include "meshpack.hpp"
+#include "tilepack.hpp"
+#include <cassert>
+
+struct DynFile {
+  uint32 hash0;
+  uint32 offset;
+  uint32 size;
+  uint32 uncompressedSize;
+  uint32 null;
+  uint32 hash1;
+};
+
+template <> void FByteswapper(DynFile &id, bool) {
+  FByteswapper(id.hash0);
+  FByteswapper(id.offset);
+  FByteswapper(id.size);
+  FByteswapper(id.uncompressedSize);
+  FByteswapper(id.hash1);
+}
+
+// File tables of dynamic pack, global.map packs have no layouts, fb and pv,
+// france.map packs have no flashes
+struct DynamicPackTables {
+  bool swappedEndian = false;
+  std::vector<DynFile> meshes;
+  std::vector<DynFile> phys;
+  std::vector<DynFile> layouts;
+  std::vector<DynFile> fbData;
+  std::vector<DynFile> pvData;
+  std::vector<DynFile> flashes;
+  std::vector<DynFile> textures;
+};
+
+inline DynamicPackTables ReadDynamicPackHeader(BinReaderRef_e &rd) {
+  DynamicPackTables retVal;
+  uint32 id;
+  rd.Read(id);
+
+  if (id != SBLA_ID) {
+    if (id == SBLA_ID_BE) {
+      rd.SwapEndian(true);
+      retVal.swappedEndian = true;
+    } else {
+      throw es::InvalidHeaderError(id);
+    }
+  }
+
+  rd.Read(id); // dummy
+  assert(id == 0);
+
+  return retVal;
+}
+
+// Number of files comes from global.map
+inline DynamicPackTables ReadDynamicPackTables(BinReaderRef_e rd,
+                                               const GlobalPackDesc &d) {
+  DynamicPackTables retVal = ReadDynamicPackHeader(rd);
+  rd.ReadContainer(retVal.meshes, d.numMehes);
+  rd.ReadContainer(retVal.phys, d.numPhys);
+  // No idea about order
+  rd.ReadContainer(retVal.flashes, d.numFlashes);
+  rd.ReadContainer(retVal.textures, d.numTextures);
+
+  return retVal;
+}
+
+// Number of files comes from france.map
+inline DynamicPackTables ReadDynamicPackTables(BinReaderRef_e rd,
+                                               const DynamicPackDesc &d) {
+  DynamicPackTables retVal = ReadDynamicPackHeader(rd);
+  rd.ReadContainer(retVal.meshes, d.numMeshes);
+  rd.ReadContainer(retVal.phys, d.numPhys);
+  // No idea about order
+  rd.ReadContainer(retVal.layouts, d.numLayouts);
+  rd.ReadContainer(retVal.fbData, d.numFB);
+  rd.ReadContainer(retVal.pvData, d.numPV);
+  rd.ReadContainer(retVal.textures, d.numTextures);
+
+  return retVal;
+}
+
+// Reader must be placed right after tables, only mesh headers are read
+inline void PlanDynamicPack(BinReaderRef_e rd, const DynamicPackTables &tables,
+                            const std::string &folder, ExtractPlan &plan,
+                            const AssetFilter &filter = {}) {
+  auto AddFiles = [&](const std::vector<DynFile> &files, AssetType type,
+                      bool stored) {
+    for (auto &df : files) {
+      if (df.size && filter.Accepts(type)) {
+        plan.Add(folder, df.size, stored ? df.size : df.uncompressedSize);
+      }
+    }
+  };
+
+  if (filter.Accepts(AssetType::Mesh)) {
+    rd.SwapEndian(tables.swappedEndian);
+
+    // Mesh pack writes up to 2 files, .msh and .dat
+    for (size_t i = 0; i < tables.meshes.size(); i++) {
+      PlanMeshPack(rd, folder, plan);
+    }
+  }
+
+  AddFiles(tables.phys, AssetType::Phys, false);
+  AddFiles(tables.layouts, AssetType::Layout, true);
+  AddFiles(tables.fbData, AssetType::FB, true);
+  AddFiles(tables.pvData, AssetType::PV, true);
+  AddFiles(tables.flashes, AssetType::Flash, true);
+  AddFiles(tables.textures, AssetType::Texture, true);
+}
+
+// Reader must be placed right after tables. With namesOnly, mesh names are
+// registered without extracting anything.
+inline void ExtractDynamicPack(BinReaderRef_e rd,
+                               const DynamicPackTables &tables,
+                               const std::string &curPath,
+                               AppExtractContext *ectx, std::string &inBuffer,
+                               std::string &outBuffer,
+                               const AssetFilter &filter = {},
+                               bool namesOnly = false) {
+  rd.SwapEndian(tables.swappedEndian);
+
+  for (auto &df : tables.meshes) {
+    if (namesOnly || !filter.Accepts(AssetType::Mesh)) {
+      hash::GetStringHash(df.hash0, SkipMeshPack(rd));
+      continue;
+    }
+
+    auto mName = ExtractMeshPack(rd, curPath, ectx, inBuffer, outBuffer);
+    hash::GetStringHash(df.hash0, mName);
+  }
+
+  if (namesOnly) {
+    return;
+  }
+
+  for (auto &df : tables.phys) {
+    if (!filter.Accepts(AssetType::Phys)) {
+      rd.Skip(df.size);
+      continue;
+    }
+
+    ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
+                  ".phy");
+    Extract(ectx, df.size, df.uncompressedSize, inBuffer, outBuffer, rd);
+  }
+
+  // Memory backed readers send views without copying
+  auto SendStored = [&](uint32 size) {
+    if (auto view = ReadView(rd.BaseStream(), size)) {
+      ectx->SendData(*view);
+    } else {
+      rd.ReadContainer(inBuffer, size);
+      ectx->SendData(inBuffer);
+    }
+  };
+
+  // Stored files
+  auto ExtractFiles = [&](const std::vector<DynFile> &files, AssetType type,
+                          const char *ext) {
+    for (auto &df : files) {
+      if (!filter.Accepts(type)) {
+        rd.Skip(df.size);
+        continue;
+      }
+
+      ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
+                    ext);
+      SendStored(df.size);
+    }
+  };
+
+  ExtractFiles(tables.layouts, AssetType::Layout, ".lay");
+  ExtractFiles(tables.fbData, AssetType::FB, ".fb");
+  ExtractFiles(tables.pvData, AssetType::PV, ".pv");
+  ExtractFiles(tables.flashes, AssetType::Flash, ".swf");
+
+  const char *dtex = rd.SwappedEndian() ? "XETD" : "DTEX";
+
+  for (auto &df : tables.textures) {
+    if (!df.size || !filter.Accepts(AssetType::Texture)) {
+      rd.Skip(df.size);
+      continue;
+    }
+
+    ectx->NewFile(curPath + std::to_string(hash::GetStringHash(df.hash0)) +
+                  ".dtex");
+    ectx->SendData(dtex);
+    SendStored(df.size);
+  }
+}
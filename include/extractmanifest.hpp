@@ -0,0 +1,257 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "dedup.hpp"
+#include "fingerprint.hpp"
+#include "spike/app_context.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include "spike/master_printer.hpp"
+#include <cinttypes>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Archive range, that produces one or more extracted files
+struct ManifestSource {
+  std::string archive;
+  uint64 offset;
+  uint64 size;
+  uint64 fingerprint;
+};
+
+// Fingerprints size bytes at current position, position is kept
+inline ManifestSource MakeManifestSource(BinReaderRef_e rd,
+                                         const std::string &archive,
+                                         uint64 size, std::string &buffer) {
+  rd.Push();
+  const uint64 offset = rd.Tell();
+  rd.ReadContainer(buffer, size);
+  rd.Pop();
+
+  return {archive, offset, size, hash::Fingerprint(buffer)};
+}
+
+// Records outputs into extract_manifest.txt of output folder, one per line:
+// <output path>\t<archive>\t<offset>\t<size>\t<fingerprint>\t<tool version>
+// Manifest of previous run is used to skip sources, that didn't change and
+// whose outputs still exist.
+// With dedup, outputs that weren't written, because they duplicate other
+// file, are looked up in dedup_manifest.txt of last run. Version must
+// differ with and without dedup.
+// output is context that writes into outputFolder, without dedup layer.
+struct ExtractManifest {
+  ExtractManifest(AppExtractContext *output, const std::string &outputFolder_,
+                  std::string_view version_,
+                  DedupExtractContext *dedup_ = nullptr)
+      : outputFolder(outputFolder_), version(version_), dedup(dedup_) {
+    if (!output->RequiresFolders()) {
+      throw std::runtime_error(
+          "Incremental extraction requires output into folder");
+    }
+
+    std::ifstream str(outputFolder / "extract_manifest.txt");
+    std::string line;
+
+    while (std::getline(str, line)) {
+      std::string_view fields[6];
+      std::string_view rest(line);
+
+      for (auto &f : fields) {
+        const size_t tab = rest.find('\t');
+        f = rest.substr(0, tab);
+        rest.remove_prefix(tab == rest.npos ? rest.size() : tab + 1);
+      }
+
+      if (fields[5] != version) {
+        continue;
+      }
+
+      // Damaged lines are ignored, their sources are extracted again
+      try {
+        Key key{std::string(fields[1]), std::stoull(std::string(fields[2]))};
+        const uint64 size = std::stoull(std::string(fields[3]));
+        const uint64 fingerprint =
+            std::stoull(std::string(fields[4]), nullptr, 16);
+        Record &rec = previous[key];
+        rec.size = size;
+        rec.fingerprint = fingerprint;
+        rec.outputs.emplace_back(fields[0]);
+      } catch (const std::logic_error &) {
+        continue;
+      }
+    }
+
+    str.close();
+    Verify(output);
+
+    if (!dedup || previous.empty()) {
+      return;
+    }
+
+    std::ifstream dedupStr(outputFolder / "dedup_manifest.txt");
+
+    while (std::getline(dedupStr, line)) {
+      const size_t tab = line.find('\t');
+
+      if (tab != line.npos) {
+        previousDuplicates.emplace(line.substr(0, tab), line.substr(tab + 1));
+      }
+    }
+  }
+
+  // Same source was extracted by last run and all its outputs exist,
+  // outputs are carried over into new manifest
+  bool Unchanged(const ManifestSource &source) {
+    auto found = previous.find(Key{source.archive, source.offset});
+
+    if (es::IsEnd(previous, found) || found->second.size != source.size ||
+        found->second.fingerprint != source.fingerprint) {
+      return false;
+    }
+
+    std::vector<std::pair<std::string, std::string>> dups;
+
+    for (auto &o : found->second.outputs) {
+      auto dup = previousDuplicates.find(o);
+
+      // File of same name might be left from older run
+      if (es::IsEnd(previousDuplicates, dup)) {
+        if (!std::filesystem::exists(outputFolder / o)) {
+          return false;
+        }
+
+        continue;
+      }
+
+      if (!std::filesystem::exists(outputFolder / dup->second)) {
+        return false;
+      }
+
+      dups.emplace_back(*dup);
+    }
+
+    if (!dups.empty() && !dedup->KeepDuplicates(dups, outputFolder)) {
+      return false;
+    }
+
+    Add(source, found->second.outputs);
+    std::lock_guard lg(mutex);
+    numSkipped++;
+
+    return true;
+  }
+
+  void Add(const ManifestSource &source, std::vector<std::string> outputs) {
+    std::lock_guard lg(mutex);
+    Record &rec = current[Key{source.archive, source.offset}];
+    rec.size = source.size;
+    rec.fingerprint = source.fingerprint;
+    rec.outputs = std::move(outputs);
+  }
+
+  void Save(AppExtractContext *ectx) const {
+    std::string manifest;
+    char buffer[64];
+
+    for (auto &[key, rec] : current) {
+      snprintf(buffer, sizeof(buffer), "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIX64,
+               key.offset, rec.size, rec.fingerprint);
+
+      for (auto &o : rec.outputs) {
+        manifest.append(o).push_back('\t');
+        manifest.append(key.archive).append(buffer).push_back('\t');
+        manifest.append(version).push_back('\n');
+      }
+    }
+
+    ectx->NewFile("extract_manifest.txt");
+    ectx->SendData(manifest);
+
+    PrintInfo("Skipped ", numSkipped, " unchanged of ", current.size(),
+              " sources");
+  }
+
+private:
+  // Output folder is only known by convention, it's verified by truncating
+  // manifest through output. When file in outputFolder stays as it was,
+  // outputs go elsewhere (custom output folder) and nothing is skipped.
+  void Verify(AppExtractContext *output) {
+    output->NewFile("extract_manifest.txt");
+    std::error_code ec;
+    const auto size =
+        std::filesystem::file_size(outputFolder / "extract_manifest.txt", ec);
+
+    if (ec || size) {
+      PrintWarning("Output is not written into ", outputFolder.string(),
+                   ", incremental extraction is disabled");
+      previous.clear();
+    }
+  }
+
+  struct Key {
+    std::string archive;
+    uint64 offset;
+
+    bool operator<(const Key &o) const {
+      return archive < o.archive || (archive == o.archive && offset < o.offset);
+    }
+  };
+
+  struct Record {
+    uint64 size = 0;
+    uint64 fingerprint = 0;
+    std::vector<std::string> outputs;
+  };
+
+  std::filesystem::path outputFolder;
+  std::string version;
+  DedupExtractContext *dedup;
+  std::map<Key, Record> previous;
+  std::map<std::string, std::string> previousDuplicates;
+  std::map<Key, Record> current;
+  std::mutex mutex;
+  size_t numSkipped = 0;
+};
+
+// Collects names of written files for ExtractManifest
+struct ManifestExtractContext : AppExtractContext {
+  ManifestExtractContext(AppExtractContext *base_) : base(base_) {}
+
+  void NewFile(const std::string &path) override {
+    outputs.emplace_back(path);
+    base->NewFile(path);
+  }
+
+  void SendData(std::string_view data) override { base->SendData(data); }
+
+  bool RequiresFolders() const override { return base->RequiresFolders(); }
+
+  void AddFolderPath(const std::string &path) override {
+    base->AddFolderPath(path);
+  }
+
+  void GenerateFolders() override { base->GenerateFolders(); }
+
+  std::vector<std::string> outputs;
+
+private:
+  AppExtractContext *base;
+};
@@ -0,0 +1,123 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/master_printer.hpp"
+#include "spike/util/supercore.hpp"
+#include "zlib.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Measures inflate speed of this machine in bytes per second, on generated
+// noise of 5 bit symbols (deflates to about 66%). Real assets deflate at
+// other ratios and speeds, so the rate is only a rough estimate.
+inline double MeasureInflateRate() {
+  std::string data(0x400000, 0);
+  uint32 seed = 0x1234567;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (seed >> 16) & 0x1f;
+  }
+
+  uLongf compSize = compressBound(data.size());
+  std::string compressed(compSize, 0);
+  compress2(reinterpret_cast<Bytef *>(compressed.data()), &compSize,
+            reinterpret_cast<const Bytef *>(data.data()), data.size(),
+            Z_DEFAULT_COMPRESSION);
+
+  auto startTime = std::chrono::steady_clock::now();
+  uLongf outSize = data.size();
+  uncompress(reinterpret_cast<Bytef *>(data.data()), &outSize,
+             reinterpret_cast<const Bytef *>(compressed.data()), compSize);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+
+  return outSize / std::max(elapsed.count(), 1e-6);
+}
+
+// Totals of extraction, that would be done, collected from tables only
+struct ExtractPlan {
+  struct Folder {
+    size_t numFiles = 0;
+    uint64 compressedSize = 0;
+    uint64 uncompressedSize = 0;
+  };
+
+  std::map<std::string, Folder> folders;
+  std::vector<std::string> missing;
+  // Uncompressed size of entries, that need inflating
+  uint64 inflatedSize = 0;
+
+  void Add(std::string_view folder, uint64 compressedSize,
+           uint64 uncompressedSize) {
+    while (folder.ends_with('/')) {
+      folder.remove_suffix(1);
+    }
+
+    Folder &f = folders[std::string(folder.empty() ? "." : folder)];
+    f.numFiles++;
+    f.compressedSize += compressedSize;
+    f.uncompressedSize += uncompressedSize;
+
+    if (compressedSize != uncompressedSize) {
+      inflatedSize += uncompressedSize;
+    }
+  }
+
+  void Missing(const std::string &name) { missing.emplace_back(name); }
+
+  void Print() const {
+    std::string report;
+    char buffer[128];
+    Folder total;
+
+    auto Row = [&](const Folder &f, std::string_view name) {
+      snprintf(buffer, sizeof(buffer), "%10zu %15" PRIu64 " %15" PRIu64 "  ",
+               f.numFiles, f.compressedSize, f.uncompressedSize);
+      report.append(buffer).append(name).push_back('\n');
+    };
+
+    report.append("     files      compressed    uncompressed  folder\n");
+
+    for (auto &[name, f] : folders) {
+      Row(f, name);
+      total.numFiles += f.numFiles;
+      total.compressedSize += f.compressedSize;
+      total.uncompressedSize += f.uncompressedSize;
+    }
+
+    Row(total, "total");
+
+    for (auto &m : missing) {
+      report.append("missing: ").append(m).push_back('\n');
+    }
+
+    PrintInfo(report);
+
+    const double inflateRate = MeasureInflateRate();
+    PrintInfo("Would read ", total.compressedSize, " bytes, inflate ",
+              inflatedSize, " bytes and write ", total.uncompressedSize,
+              " bytes. Estimated inflate time: ", inflatedSize / inflateRate,
+              "s at ", inflateRate / 0x100000, " MiB/s.");
+  }
+};
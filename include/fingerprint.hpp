@@ -0,0 +1,202 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/util/supercore.hpp"
+#include <array>
+#include <cstring>
+#include <string_view>
+
+namespace hash {
+// XXH64, used only for content comparison, not for game lookups
+namespace detail {
+static constexpr uint64 XXP1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64 XXP2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64 XXP3 = 0x165667B19E3779F9ULL;
+static constexpr uint64 XXP4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64 XXP5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64 Rotl(uint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64 Round(uint64 acc, uint64 input) {
+  acc += input * XXP2;
+  acc = Rotl(acc, 31);
+  return acc * XXP1;
+}
+
+inline uint64 MergeRound(uint64 acc, uint64 val) {
+  acc ^= Round(0, val);
+  return acc * XXP1 + XXP4;
+}
+
+inline uint64 Read64(const char *data) {
+  uint64 retVal;
+  memcpy(&retVal, data, sizeof(retVal));
+  return retVal;
+}
+
+inline uint32 Read32(const char *data) {
+  uint32 retVal;
+  memcpy(&retVal, data, sizeof(retVal));
+  return retVal;
+}
+} // namespace detail
+
+inline uint64 Fingerprint(std::string_view data, uint64 seed = 0) {
+  using namespace detail;
+  const char *cur = data.data();
+  const char *end = cur + data.size();
+  uint64 h64;
+
+  if (data.size() >= 32) {
+    uint64 v1 = seed + XXP1 + XXP2;
+    uint64 v2 = seed + XXP2;
+    uint64 v3 = seed;
+    uint64 v4 = seed - XXP1;
+
+    for (; end - cur >= 32; cur += 32) {
+      v1 = Round(v1, Read64(cur));
+      v2 = Round(v2, Read64(cur + 8));
+      v3 = Round(v3, Read64(cur + 16));
+      v4 = Round(v4, Read64(cur + 24));
+    }
+
+    h64 = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+    h64 = MergeRound(h64, v1);
+    h64 = MergeRound(h64, v2);
+    h64 = MergeRound(h64, v3);
+    h64 = MergeRound(h64, v4);
+  } else {
+    h64 = seed + XXP5;
+  }
+
+  h64 += data.size();
+
+  for (; end - cur >= 8; cur += 8) {
+    h64 ^= Round(0, Read64(cur));
+    h64 = Rotl(h64, 27) * XXP1 + XXP4;
+  }
+
+  if (end - cur >= 4) {
+    h64 ^= uint64(Read32(cur)) * XXP1;
+    h64 = Rotl(h64, 23) * XXP2 + XXP3;
+    cur += 4;
+  }
+
+  for (; cur < end; cur++) {
+    h64 ^= uint8(*cur) * XXP5;
+    h64 = Rotl(h64, 11) * XXP1;
+  }
+
+  h64 ^= h64 >> 33;
+  h64 *= XXP2;
+  h64 ^= h64 >> 29;
+  h64 *= XXP3;
+  h64 ^= h64 >> 32;
+
+  return h64;
+}
+
+namespace detail {
+inline uint32 Rotl32(uint32 x, int r) { return (x << r) | (x >> (32 - r)); }
+
+inline void Sha1Block(uint32 state[5], const uint8 *block) {
+  uint32 w[80];
+
+  for (size_t i = 0; i < 16; i++) {
+    w[i] = uint32(block[i * 4]) << 24 | uint32(block[i * 4 + 1]) << 16 |
+           uint32(block[i * 4 + 2]) << 8 | block[i * 4 + 3];
+  }
+
+  for (size_t i = 16; i < 80; i++) {
+    w[i] = Rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+  for (size_t i = 0; i < 80; i++) {
+    uint32 f;
+    uint32 k;
+
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+
+    const uint32 temp = Rotl32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = Rotl32(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+} // namespace detail
+
+using Digest = std::array<uint8, 20>;
+
+// SHA-1, equal digests of equal sized data are treated as equal contents
+inline Digest StrongFingerprint(std::string_view data) {
+  using namespace detail;
+  uint32 state[5]{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                  0xC3D2E1F0};
+  const uint8 *cur = reinterpret_cast<const uint8 *>(data.data());
+  size_t left = data.size();
+
+  for (; left >= 64; cur += 64, left -= 64) {
+    Sha1Block(state, cur);
+  }
+
+  // Padding and bit length, one or two blocks
+  uint8 tail[128]{};
+  memcpy(tail, cur, left);
+  tail[left] = 0x80;
+  const size_t tailSize = left < 56 ? 64 : 128;
+  const uint64 numBits = uint64(data.size()) * 8;
+
+  for (size_t i = 0; i < 8; i++) {
+    tail[tailSize - 1 - i] = uint8(numBits >> (i * 8));
+  }
+
+  for (size_t i = 0; i < tailSize; i += 64) {
+    Sha1Block(state, tail + i);
+  }
+
+  Digest retVal;
+
+  for (size_t i = 0; i < 20; i++) {
+    retVal[i] = uint8(state[i / 4] >> (24 - (i % 4) * 8));
+  }
+
+  return retVal;
+}
+} // namespace hash
@@ -0,0 +1,214 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "hashstorage.hpp"
+#include "installindex.hpp"
+#include "loosefiles.hpp"
+#include "spike/except.hpp"
+#include "spike/master_printer.hpp"
+#include <cassert>
+
+struct FrancePath {
+  std::string longPath;
+  std::string name0;
+  float unk[12];
+  std::string name1;
+
+  void Read(BinReaderRef_e rd) {
+    rd.ReadContainer(longPath);
+    rd.ReadContainer(name0);
+    rd.Read(unk);
+    rd.ReadContainer(name1);
+
+    longPath = longPath.c_str();
+    name0 = name0.c_str();
+    name1 = name1.c_str();
+
+    hash::GetStringHash(hash::GetHash(longPath), longPath);
+    hash::GetStringHash(hash::GetHash(name0), name0);
+    hash::GetStringHash(hash::GetHash(name1), name1);
+  }
+};
+
+struct Tile {
+  uint32 hash;
+  uint16 nameLen;
+  float bounds[6]; // min xyz, max xyz ??
+  uint16 null;
+  uint16 lod; //??
+
+  uint32 null0[13];
+  std::vector<uint32> hashes;
+  uint32 null1;
+
+  void Read(BinReaderRef_e rd) {
+    rd.Read(hash);
+    rd.Read(nameLen);
+    rd.Read(bounds);
+    rd.Read(null);
+    rd.Read(lod);
+
+    assert(nameLen == 0);
+    assert(null == 0);
+    assert(lod < 3);
+
+    if (lod == 2) {
+      rd.Read(null0);
+      rd.ReadContainer(hashes);
+      rd.Read(null1);
+      assert(null1 == 0);
+    }
+  }
+};
+
+struct DynamicPackDesc {
+  uint32 hash;
+  std::string name;
+  float unk0[6];
+  uint16 unk1[2];
+  uint32 null0[2];
+  uint32 dataStart;
+  uint32 numMeshes;
+  uint32 numTextures;
+  uint32 numPhys;
+  uint32 numLayouts;
+  uint32 numFB;
+  uint32 null1[3];
+  uint32 numPV;
+  uint32 null2;
+  std::vector<uint32> files;
+  uint32 null;
+
+  void Read(BinReaderRef_e rd) {
+    rd.Read(hash);
+    rd.ReadContainer<uint16>(name);
+    name = name.c_str();
+    rd.Read(unk0);
+    rd.Read(unk1);
+    rd.Read(null0);
+    rd.Read(dataStart);
+    rd.Read(numMeshes);
+    rd.Read(numTextures);
+    rd.Read(numPhys);
+    rd.Read(numLayouts);
+    rd.Read(numFB);
+    rd.Read(null1);
+    rd.Read(numPV);
+    rd.Read(null2);
+    rd.ReadContainer(files);
+    rd.Read(null);
+
+    assert(null == 0);
+    assert(!name.empty());
+    assert(null0[0] == 0);
+    assert(null0[1] == 0);
+    assert(null1[0] == 0);
+    assert(null1[1] == 0);
+    assert(null1[2] == 0);
+    assert(null2 == 0);
+  }
+};
+
+struct FranceMapItems {
+  std::vector<Tile> tiles;
+  std::vector<DynamicPackDesc> packs;
+};
+
+inline FranceMapItems LoadFranceMap(BinReaderRef_e rd) {
+  static constexpr uint32 MAP6_ID = CompileFourCC("6PAM");
+  static constexpr uint32 MAP6_ID_BE = CompileFourCC("MAP6");
+
+  uint32 id;
+  rd.Read(id);
+  if (id != MAP6_ID) {
+    if (id == MAP6_ID_BE) {
+      rd.SwapEndian(true);
+    } else {
+      throw es::InvalidHeaderError(id);
+    }
+  }
+
+  std::string mapName;
+  rd.ReadString(mapName);
+
+  uint32 numTiles;
+  rd.Read(numTiles);
+  const bool isDLC = numTiles == 0;
+
+  if (isDLC) {
+    rd.Read(numTiles);
+  } else {
+    uint32 unk0;
+    uint32 numPaths;
+    uint32 unk1;
+
+    rd.Read(unk0);
+    rd.Read(numPaths);
+    rd.Read(unk1);
+
+    FrancePath dummy;
+
+    for (size_t i = 0; i < numPaths; ++i) {
+      rd.Read(dummy);
+    }
+
+    float unk2[18];
+    rd.Read(unk2);
+    uint16 unk3[6];
+    rd.Read(unk3);
+  }
+
+  std::vector<Tile> tiles;
+  rd.ReadContainer(tiles, numTiles);
+
+  std::vector<DynamicPackDesc> dyn0;
+  rd.ReadContainer(dyn0);
+  std::vector<DynamicPackDesc> dyn1;
+  rd.ReadContainer(dyn1);
+
+  dyn0.insert(dyn0.end(), dyn1.begin(), dyn1.end());
+
+  return {tiles, dyn0};
+}
+
+// Looks up france.map inside loosefiles package, or as a loose file
+inline FranceMapItems FindFranceMap(const InstallIndex &install,
+                                    bool useIndexCache = false) {
+  try {
+    auto looseFiles = install.Open("loosefiles_", ".pack");
+    BinReaderRef rd(*looseFiles.Get());
+
+    if (!useIndexCache) {
+      if (FindLooseFile(rd, "rance.map")) {
+        return LoadFranceMap(rd);
+      }
+    } else {
+      LooseFilesIndex index =
+          LoadLooseFilesIndex(rd, looseFiles.path.string(), true);
+
+      if (const LooseFile *franceMap = index.FindSuffix("rance.map")) {
+        rd.Seek(franceMap->offset);
+        return LoadFranceMap(rd);
+      }
+    }
+  } catch (const es::FileNotFoundError &) {
+  }
+
+  auto found = install.Open("france.map");
+  return LoadFranceMap(*found.Get());
+}
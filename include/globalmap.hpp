@@ -0,0 +1,136 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "installindex.hpp"
+#include "loosefiles.hpp"
+#include "megapack.hpp"
+#include "spike/except.hpp"
+#include <cassert>
+
+struct GlobalPackDesc {
+  uint32 assetIndex;
+  std::string name;
+  uint8 data[28];
+  std::vector<FileId> textures;
+  std::vector<FileId> meshes;
+  uint32 dataOffset;
+  uint32 numMehes;
+  uint32 numTextures;
+  uint32 numPhys;
+  uint32 unk0;
+  uint32 unk1;
+  uint32 unk2;
+  uint32 unk3;
+  uint32 numFlashes;
+  uint32 unk5;
+  uint32 unk6;
+  uint32 unk7;
+  uint32 unk8;
+
+  void Read(BinReaderRef_e rd) {
+    rd.Read(assetIndex);
+    rd.ReadContainer<uint16>(name);
+    name = name.c_str();
+    rd.Read(data);
+    rd.ReadContainer(textures);
+    rd.ReadContainer(meshes);
+    rd.Read(dataOffset);
+    rd.Read(numMehes);
+    rd.Read(numTextures);
+    rd.Read(numPhys);
+    rd.Read(unk0);
+    rd.Read(unk1);
+    rd.Read(unk2);
+    rd.Read(unk3);
+    rd.Read(numFlashes);
+    rd.Read(unk5);
+    rd.Read(unk6);
+    rd.Read(unk7);
+    rd.Read(unk8);
+
+    assert(unk0 == 0);
+    assert(unk1 == 0);
+    assert(unk2 == 0);
+    assert(unk3 == 0);
+    assert(unk5 == 0);
+    assert(unk6 == 0);
+    assert(unk7 == 0);
+    assert(unk8 == 0);
+
+    if (numFlashes) {
+      assert(numMehes == 0);
+      assert(numPhys == 0);
+    }
+  }
+};
+
+inline std::vector<GlobalPackDesc> LoadGlobalMap(BinReaderRef_e rd) {
+  static constexpr uint32 MAP6_ID = CompileFourCC("6PAM");
+  static constexpr uint32 MAP6_ID_BE = CompileFourCC("MAP6");
+
+  uint32 id;
+  rd.Read(id);
+  if (id != MAP6_ID) {
+    if (id == MAP6_ID_BE) {
+      rd.SwapEndian(true);
+    } else {
+      throw es::InvalidHeaderError(id);
+    }
+  }
+
+  uint32 numDynamics;
+  rd.Read(numDynamics);
+  std::vector<GlobalPackDesc> idkPreloadPatterns;
+  rd.ReadContainer(idkPreloadPatterns);
+  std::vector<GlobalPackDesc> patterns;
+  rd.ReadContainer(patterns);
+
+  std::vector<GlobalPackDesc> dynamics;
+  rd.ReadContainer(dynamics, numDynamics);
+
+  dynamics.insert(dynamics.end(), patterns.begin(), patterns.end());
+
+  return dynamics;
+}
+
+// Looks up global.map inside loosefiles package, or as a loose file
+inline std::vector<GlobalPackDesc> FindGlobalMap(const InstallIndex &install,
+                                                 bool useIndexCache = false) {
+  try {
+    auto looseFiles = install.Open("loosefiles_", ".pack");
+    BinReaderRef rd(*looseFiles.Get());
+
+    if (!useIndexCache) {
+      if (FindLooseFile(rd, "lobal.map")) {
+        return LoadGlobalMap(rd);
+      }
+    } else {
+      LooseFilesIndex index =
+          LoadLooseFilesIndex(rd, looseFiles.path.string(), true);
+
+      if (const LooseFile *globalMap = index.FindSuffix("lobal.map")) {
+        rd.Seek(globalMap->offset);
+        return LoadGlobalMap(rd);
+      }
+    }
+  } catch (const es::FileNotFoundError &) {
+  }
+
+  auto found = install.Open("global.map");
+  return LoadGlobalMap(*found.Get());
+}
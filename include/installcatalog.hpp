@@ -0,0 +1,368 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "assetcatalog.hpp"
+#include "cinpack.hpp"
+#include "dynpack.hpp"
+#include "francemap.hpp"
+#include "hashstorage.hpp"
+#include "installindex.hpp"
+#include "loosefiles.hpp"
+#include "luapack.hpp"
+#include "megapack.hpp"
+#include "memstream.hpp"
+#include "spike/io/stat.hpp"
+#include "spike/master_printer.hpp"
+#include "tilepack.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+
+inline CatalogType TileCatalogType(TileEntryType type) {
+  switch (type) {
+  case TileEntryType::Mesh:
+    return CatalogType::Mesh;
+  case TileEntryType::Phys:
+    return CatalogType::Phys;
+  case TileEntryType::Layout:
+    return CatalogType::Layout;
+  case TileEntryType::FB:
+    return CatalogType::FB;
+  case TileEntryType::PV:
+    return CatalogType::PV;
+  case TileEntryType::Mask:
+    return CatalogType::Mask;
+  default:
+    return CatalogType::Texture;
+  }
+}
+
+inline std::string_view CatalogSubView(std::string_view data, size_t offset,
+                                       size_t size) {
+  if (offset > data.size() || size > data.size() - offset) {
+    throw std::runtime_error("Entry out of archive bounds");
+  }
+
+  return data.substr(offset, size);
+}
+
+// Dynamic packs of one map by hash, their file tables can be only read with
+// numbers of files from global.map or france.map
+struct CatalogDynamicPack {
+  std::string_view name;
+  std::function<DynamicPackTables(BinReaderRef_e)> readTables;
+};
+
+using CatalogDynamicPacks = std::map<uint32, CatalogDynamicPack>;
+
+// Entries are walked in the same order as ExtractDynamicPack writes them
+inline void CatalogDynamicPackEntries(AssetCatalogBuilder &catalog,
+                                      uint16 archive, std::string_view data,
+                                      uint64 offset, uint32 pack,
+                                      const CatalogDynamicPack &desc) {
+  MemoryStream packStream(data);
+  const DynamicPackTables tables = desc.readTables(packStream);
+  BinReaderRef_e rd(packStream);
+  rd.SwapEndian(tables.swappedEndian);
+  const std::string folder = std::string(desc.name) + '/';
+
+  for (auto &df : tables.meshes) {
+    const uint64 meshOffset = rd.Tell();
+    MSHA msha;
+    rd.Read(msha);
+
+    if (msha.id != MSHA_ID) {
+      throw es::InvalidHeaderError(msha.id);
+    }
+
+    rd.Skip(msha.compressedSize0 + msha.compressedSize1);
+    const uint32 size = rd.Tell() - meshOffset;
+    CatalogSubView(data, meshOffset, size);
+    hash::GetStringHash(df.hash0, msha.name);
+    catalog.Add({df.hash0, 0, offset + meshOffset, size,
+                 msha.uncompressedSize0 + msha.uncompressedSize1, pack,
+                 archive, CatalogType::Mesh},
+                folder + msha.name + ".msh");
+  }
+
+  auto AddFiles = [&](const std::vector<DynFile> &files, CatalogType type,
+                      const char *ext, bool stored) {
+    for (auto &df : files) {
+      const uint64 fileOffset = rd.Tell();
+      CatalogSubView(data, fileOffset, df.size);
+      rd.Skip(df.size);
+
+      if (!df.size) {
+        continue;
+      }
+
+      catalog.Add({df.hash0, 0, offset + fileOffset, df.size,
+                   stored ? df.size : df.uncompressedSize, pack, archive,
+                   type},
+                  folder + std::to_string(hash::GetStringHash(df.hash0)) +
+                      ext);
+    }
+  };
+
+  AddFiles(tables.phys, CatalogType::Phys, ".phy", false);
+  AddFiles(tables.layouts, CatalogType::Layout, ".lay", true);
+  AddFiles(tables.fbData, CatalogType::FB, ".fb", true);
+  AddFiles(tables.pvData, CatalogType::PV, ".pv", true);
+  AddFiles(tables.flashes, CatalogType::Flash, ".swf", true);
+  AddFiles(tables.textures, CatalogType::Texture, ".dtex", true);
+}
+
+// Tile pack and dynamic pack entries are recorded with their containing pack.
+// Dynamic packs are named after packs of dynamicPacks, packs not found there
+// are recorded without entries.
+inline void CatalogMegaPack(AssetCatalogBuilder &catalog, uint16 archive,
+                            std::string_view data,
+                            const CatalogDynamicPacks &dynamicPacks = {}) {
+  MemoryStream packStream(data);
+
+  for (auto &[id, range] : LoadMegaPack(packStream)) {
+    const std::string_view entry =
+        CatalogSubView(data, range.offset, range.size);
+    const std::string name = std::to_string(hash::GetStringHash(id));
+    uint32 fourCC = 0;
+    memcpy(&fourCC, entry.data(), std::min<size_t>(entry.size(), 4));
+    CatalogType type = CatalogType::Data;
+
+    if (IsTilePack(entry)) {
+      type = CatalogType::TilePack;
+    } else if (fourCC == SBLA_ID || fourCC == SBLA_ID_BE) {
+      type = CatalogType::DynamicPack;
+    }
+
+    auto dynamicPack = dynamicPacks.find(id);
+    const bool knownDynamic = type == CatalogType::DynamicPack &&
+                              !es::IsEnd(dynamicPacks, dynamicPack);
+    const uint32 pack = catalog.Add(
+        {id, 0, range.offset, range.size, range.size, CATALOG_NONE, archive,
+         type},
+        knownDynamic ? std::string(dynamicPack->second.name) : name);
+
+    if (knownDynamic) {
+      // Broken dynamic pack keeps records of entries walked so far
+      try {
+        CatalogDynamicPackEntries(catalog, archive, entry, range.offset, pack,
+                                  dynamicPack->second);
+      } catch (const std::exception &e) {
+        PrintWarning("Skipped entries of dynamic pack ",
+                     dynamicPack->second.name, ": ", e.what());
+      }
+
+      continue;
+    }
+
+    if (type != CatalogType::TilePack) {
+      continue;
+    }
+
+    // Broken tile pack keeps only its own record
+    try {
+      MemoryStream tileStream(entry);
+
+      for (auto &e : IndexTilePack(tileStream).entries) {
+        catalog.Add({e.hash, 0, range.offset + e.offset, e.size,
+                     e.uncompressedSize, pack, archive,
+                     TileCatalogType(e.type)},
+                    name + '/' + e.FileName());
+      }
+    } catch (const std::exception &e) {
+      PrintWarning("Skipped entries of tile pack ", name, ": ", e.what());
+    }
+  }
+}
+
+// Cinematics are named after dynamic packs of france.map, when available.
+// Cinematics of nested cinpack are prefixed by its loose file name.
+inline void CatalogCinpack(AssetCatalogBuilder &catalog, uint16 archive,
+                           std::string_view data, uint64 offset,
+                           uint32 container, const FranceMapItems *franceMap,
+                           const std::string &prefix = {}) {
+  std::map<uint32, std::string_view> names;
+
+  if (franceMap) {
+    for (auto &d : franceMap->packs) {
+      names.emplace(d.hash, d.name);
+    }
+  }
+
+  MemoryStream cinStream(data);
+
+  for (auto &[id, cin] : LoadCinpack(cinStream, data.size())) {
+    CatalogSubView(data, cin.offset, cin.size);
+    auto found = names.find(id);
+    const std::string name = es::IsEnd(names, found)
+                                 ? std::to_string(hash::GetStringHash(id))
+                                 : std::string(found->second);
+    catalog.Add({id, 0, offset + cin.offset, cin.size, cin.size, container,
+                 archive, CatalogType::Cinematic},
+                prefix + name + ".cin");
+  }
+}
+
+inline void CatalogLooseFiles(AssetCatalogBuilder &catalog, uint16 archive,
+                              std::string_view data) {
+  const LooseFilesIndex index(data);
+  const LooseFile *cinpack = nullptr;
+  uint32 cinpackRecord = CATALOG_NONE;
+  std::optional<FranceMapItems> franceMap;
+
+  for (auto &f : index.files) {
+    const uint32 record =
+        catalog.Add({f.hash, 0, f.offset, f.size, f.size, CATALOG_NONE,
+                     archive, CatalogType::LooseFile},
+                    f.name);
+
+    if (f.name.ends_with("inematics.cinpack")) {
+      cinpack = &f;
+      cinpackRecord = record;
+    } else if (f.name.ends_with("rance.map")) {
+      MemoryStream mapStream(data.substr(f.offset, f.size));
+      franceMap = LoadFranceMap(mapStream);
+    }
+  }
+
+  if (cinpack) {
+    CatalogCinpack(catalog, archive,
+                   data.substr(cinpack->offset, cinpack->size),
+                   cinpack->offset, cinpackRecord,
+                   franceMap ? &*franceMap : nullptr, cinpack->name + '/');
+  }
+}
+
+inline void CatalogLuaPack(AssetCatalogBuilder &catalog, uint16 archive,
+                           std::string_view data) {
+  MemoryStream luaStream(data);
+  BinReaderRef rd(luaStream);
+
+  for (auto &f : LoadLuaPack(rd)) {
+    const std::string name = LuaSourceName(rd, f);
+    catalog.Add({hash::GetHash(name), 0, f.offset, f.compressedSize,
+                 f.uncompressedSize, CATALOG_NONE, archive, CatalogType::Lua},
+                name);
+  }
+}
+
+// Scans tables of every archive under install folder once.
+// Archive paths are stored relative to install folder.
+inline AssetCatalogBuilder BuildInstallCatalog(const InstallIndex &install,
+                                               const std::string &root) {
+  namespace fs = std::filesystem;
+  auto startTime = std::chrono::steady_clock::now();
+  AssetCatalogBuilder catalog;
+  std::map<std::string, fs::path> archives;
+
+  for (auto &[name, paths] : install.files) {
+    const bool isArchive =
+        name.ends_with(".megapack") || name.ends_with(".luap") ||
+        name == "cinematics.cinpack" || name == "animations.pack" ||
+        (name.starts_with("loosefiles_") && name.ends_with(".pack"));
+
+    if (!isArchive) {
+      continue;
+    }
+
+    for (auto &p : paths) {
+      archives.emplace(fs::relative(p, root).generic_string(), p);
+    }
+  }
+
+  // Loosefiles package holds its own france.map for cinematics
+  std::optional<FranceMapItems> franceMap;
+  std::vector<GlobalPackDesc> globalMap;
+
+  try {
+    franceMap = FindFranceMap(install);
+  } catch (const std::exception &e) {
+    PrintWarning("Dynamic packs of france.map are not named: ", e.what());
+  }
+
+  try {
+    globalMap = FindGlobalMap(install);
+  } catch (const std::exception &e) {
+    PrintWarning("Dynamic packs of global.map are not named: ", e.what());
+  }
+
+  // global.map packs are in dynamic0 and palettes0, france.map packs in mega*
+  CatalogDynamicPacks globalPacks;
+  CatalogDynamicPacks francePacks;
+
+  for (auto &d : globalMap) {
+    globalPacks.emplace(
+        d.assetIndex,
+        CatalogDynamicPack{d.name, [&d](BinReaderRef_e rd) {
+                             return ReadDynamicPackTables(rd, d);
+                           }});
+  }
+
+  if (franceMap) {
+    for (auto &d : franceMap->packs) {
+      francePacks.emplace(
+          d.hash, CatalogDynamicPack{d.name, [&d](BinReaderRef_e rd) {
+                                       return ReadDynamicPackTables(rd, d);
+                                     }});
+    }
+  }
+
+  for (auto &[relPath, path] : archives) {
+    const size_t numRecords = catalog.NumRecords();
+    const std::string name = ToLower(path.filename().string());
+    const uint16 archive = catalog.AddArchive(relPath);
+
+    try {
+      const es::MappedFile mappedFile(path.string());
+      const std::string_view data(static_cast<const char *>(mappedFile.data),
+                                  mappedFile.fileSize);
+
+      if (name.ends_with(".megapack")) {
+        CatalogMegaPack(catalog, archive, data,
+                        name.starts_with("mega") ? francePacks : globalPacks);
+      } else if (name.ends_with(".luap")) {
+        CatalogLuaPack(catalog, archive, data);
+      } else if (name == "cinematics.cinpack") {
+        CatalogCinpack(catalog, archive, data, 0, CATALOG_NONE,
+                       franceMap ? &*franceMap : nullptr);
+      } else if (name == "animations.pack") {
+        // Single hkx stream with metadata, there are no separate assets
+        catalog.Add({hash::GetHash(name), 0, 0, uint32(data.size()),
+                     uint32(data.size()), CATALOG_NONE, archive,
+                     CatalogType::Animations},
+                    name);
+      } else {
+        CatalogLooseFiles(catalog, archive, data);
+      }
+    } catch (const std::exception &e) {
+      PrintWarning("Skipped rest of ", relPath, ": ", e.what());
+    }
+
+    PrintInfo(relPath, ": ", catalog.NumRecords() - numRecords, " records");
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  PrintInfo("Cataloged ", catalog.NumRecords(), " records of ",
+            archives.size(), " archives in ", elapsed.count(), "s");
+
+  return catalog;
+}
@@ -0,0 +1,158 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/except.hpp"
+#include "spike/master_printer.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+inline std::string ToLower(std::string_view str) {
+  std::string retVal(str);
+  std::transform(retVal.begin(), retVal.end(), retVal.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return retVal;
+}
+
+// Opened file of InstallIndex
+struct InstallFileStream {
+  std::filesystem::path path;
+  std::unique_ptr<std::ifstream> stream;
+
+  std::istream *Get() { return stream.get(); }
+};
+
+// All files under install folder, collected by single recursive scan and
+// keyed by lowercase file name. Lookups are case insensitive.
+struct InstallIndex {
+  std::unordered_map<std::string, std::vector<std::filesystem::path>> files;
+
+  InstallIndex(const std::string &root) {
+    namespace fs = std::filesystem;
+    auto startTime = std::chrono::steady_clock::now();
+    size_t numFiles = 0;
+
+    for (auto &e : fs::recursive_directory_iterator(
+             root, fs::directory_options::skip_permission_denied)) {
+      if (e.is_regular_file()) {
+        files[ToLower(e.path().filename().string())].emplace_back(e.path());
+        numFiles++;
+      }
+    }
+
+    // Directory iteration order is unspecified, lookups pick first path
+    for (auto &[name, paths] : files) {
+      std::sort(paths.begin(), paths.end());
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - startTime;
+    PrintInfo("Indexed ", numFiles, " files of ", root, " in ",
+              elapsed.count(), "s");
+  }
+
+  // Name might contain parent folders, for example "global/dynamic0.megapack"
+  const std::filesystem::path *Find(std::string_view name) const {
+    const std::string lowName = ToLower(name);
+    const size_t lastSlash = lowName.find_last_of("/\\");
+    auto found = files.find(lowName.substr(lastSlash + 1));
+
+    if (es::IsEnd(files, found)) {
+      return nullptr;
+    }
+
+    if (lastSlash == lowName.npos) {
+      return &found->second.front();
+    }
+
+    for (auto &p : found->second) {
+      std::string lowPath = ToLower(p.generic_string());
+      std::replace(lowPath.begin(), lowPath.end(), '\\', '/');
+
+      if (lowPath.ends_with('/' + lowName)) {
+        return &p;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // For name patterns like "loosefiles_*.pack"
+  // When more names match, the lowest one is used, so "loosefiles_x.pack" is
+  // preferred over "loosefiles_x_new.pack"
+  const std::filesystem::path *Find(std::string_view prefix,
+                                    std::string_view suffix) const {
+    const std::string lowPrefix = ToLower(prefix);
+    const std::string lowSuffix = ToLower(suffix);
+    const std::string *foundName = nullptr;
+    const std::filesystem::path *retVal = nullptr;
+    size_t numFound = 0;
+
+    for (auto &[name, paths] : files) {
+      if (name.size() >= lowPrefix.size() + lowSuffix.size() &&
+          name.starts_with(lowPrefix) && name.ends_with(lowSuffix)) {
+        numFound += paths.size();
+
+        if (!foundName || name < *foundName) {
+          foundName = &name;
+          retVal = &paths.front();
+        }
+      }
+    }
+
+    if (numFound > 1) {
+      PrintWarning(numFound, " files match ", prefix, "*", suffix, ", using ",
+                   retVal->string());
+    }
+
+    return retVal;
+  }
+
+  InstallFileStream Open(std::string_view name) const {
+    return OpenPath(Find(name), name);
+  }
+
+  InstallFileStream Open(std::string_view prefix,
+                         std::string_view suffix) const {
+    return OpenPath(Find(prefix, suffix),
+                    std::string(prefix).append("*").append(suffix));
+  }
+
+private:
+  static InstallFileStream OpenPath(const std::filesystem::path *path,
+                                    std::string_view name) {
+    if (!path) {
+      throw es::FileNotFoundError(std::string(name));
+    }
+
+    InstallFileStream retVal{*path, std::make_unique<std::ifstream>(
+                                        *path, std::ios::binary)};
+
+    if (retVal.stream->fail()) {
+      throw es::FileInvalidAccessError(path->string());
+    }
+
+    return retVal;
+  }
+};
@@ -0,0 +1,286 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/except.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include "spike/io/binwritter_stream.hpp"
+#include "spike/master_printer.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+static constexpr uint32 LFIX_ID = CompileFourCC("LFIX");
+static constexpr uint32 LFIX_VERSION = 2;
+
+struct LooseFile {
+  uint32 hash;
+  uint64 offset; // data offset
+  uint32 size;
+  std::string name;
+
+  // Reads archive header of entry, rd is left at its data
+  void ReadHeader(BinReaderRef rd) {
+    rd.Read(hash);
+    rd.Read(size);
+    char fileName[120];
+    rd.Read(fileName);
+    name.assign(fileName, strnlen(fileName, sizeof(fileName)));
+    offset = rd.Tell();
+  }
+
+  void Read(BinReaderRef rd) {
+    rd.Read(hash);
+    rd.Read(offset);
+    rd.Read(size);
+    rd.ReadContainer(name);
+  }
+
+  void Write(BinWritterRef wr) const {
+    wr.Write(hash);
+    wr.Write(offset);
+    wr.Write(size);
+    wr.WriteContainerWCount(name);
+  }
+};
+
+/*
+loosefiles pack layout:
+  struct {
+    uint32 hash;
+    uint32 dataSize;
+    char name[120];
+    char data[dataSize];
+    pad to 16 bytes
+  } files[];
+*/
+struct LooseFilesIndex {
+  // In archive order
+  std::vector<LooseFile> files;
+  std::map<std::string, size_t, std::less<>> names;
+
+  LooseFilesIndex() = default;
+
+  // Walks headers only
+  LooseFilesIndex(BinReaderRef rd) {
+    const size_t filesSize = rd.GetSize();
+
+    while (rd.Tell() < filesSize) {
+      LooseFile file;
+      file.ReadHeader(rd);
+      files.emplace_back(std::move(file));
+      rd.Skip(files.back().size);
+      rd.ApplyPadding(16);
+    }
+
+    BuildNames();
+  }
+
+  // Walks headers of archive mapped into memory
+  LooseFilesIndex(std::string_view data) {
+    static constexpr size_t HEADER_SIZE = 8 + 120;
+    size_t pos = 0;
+
+    while (pos < data.size()) {
+      if (data.size() - pos < HEADER_SIZE) {
+        throw std::runtime_error("Truncated loosefiles header");
+      }
+
+      LooseFile file;
+      memcpy(&file.hash, data.data() + pos, 4);
+      memcpy(&file.size, data.data() + pos + 4, 4);
+      const char *name = data.data() + pos + 8;
+      file.name.assign(name, strnlen(name, 120));
+      file.offset = pos + HEADER_SIZE;
+
+      if (data.size() - file.offset < file.size) {
+        throw std::runtime_error("Truncated loosefiles entry: " + file.name);
+      }
+
+      pos = (file.offset + file.size + 15) & ~size_t(15);
+      files.emplace_back(std::move(file));
+    }
+
+    BuildNames();
+  }
+
+  const LooseFile *Find(std::string_view name) const {
+    auto found = names.find(name);
+    return es::IsEnd(names, found) ? nullptr : &files[found->second];
+  }
+
+  // Archive names are stored with paths, lookups are done by their endings
+  const LooseFile *FindSuffix(std::string_view suffix) const {
+    for (auto &f : files) {
+      if (std::string_view(f.name).ends_with(suffix)) {
+        return &f;
+      }
+    }
+
+    return nullptr;
+  }
+
+  /*
+  Cache file (<archive>.idx), little endian
+    uint32 id; // LFIX
+    uint32 version;
+    uint64 archiveSize;
+    int64 archiveTime;
+    uint32 numFiles;
+    LooseFile files[numFiles];
+  */
+  // Truncated or corrupted cache is reported and ignored
+  bool LoadCache(const std::string &archivePath) {
+    namespace fs = std::filesystem;
+    std::ifstream str(archivePath + ".idx", std::ios::binary);
+
+    if (str.fail()) {
+      return false;
+    }
+
+    try {
+      BinReaderRef rd(str);
+      uint32 id;
+      uint32 version;
+      uint64 archiveSize;
+      int64 archiveTime;
+      rd.Read(id);
+      rd.Read(version);
+      rd.Read(archiveSize);
+      rd.Read(archiveTime);
+
+      if (id != LFIX_ID || version != LFIX_VERSION ||
+          archiveSize != fs::file_size(archivePath) ||
+          archiveTime !=
+              fs::last_write_time(archivePath).time_since_epoch().count()) {
+        return false;
+      }
+
+      // Every record takes at least 20 bytes
+      uint32 numFiles;
+      rd.Read(numFiles);
+
+      if (uint64(numFiles) * 20 > fs::file_size(archivePath + ".idx")) {
+        throw std::runtime_error("Truncated file table");
+      }
+
+      rd.ReadContainer(files, numFiles);
+
+      if (str.fail()) {
+        throw std::runtime_error("Truncated file table");
+      }
+
+      for (auto &f : files) {
+        if (f.offset + f.size > archiveSize) {
+          throw std::runtime_error("Entry out of archive bounds: " + f.name);
+        }
+      }
+    } catch (const std::exception &e) {
+      PrintWarning("Ignoring loosefiles index cache ", archivePath,
+                   ".idx: ", e.what());
+      files.clear();
+      return false;
+    }
+
+    BuildNames();
+
+    return true;
+  }
+
+  void SaveCache(const std::string &archivePath) const {
+    namespace fs = std::filesystem;
+    std::ofstream str(archivePath + ".idx", std::ios::binary);
+
+    if (str.fail()) {
+      PrintWarning("Cannot write loosefiles index cache: ", archivePath,
+                   ".idx");
+      return;
+    }
+
+    BinWritterRef wr(str);
+    wr.Write(LFIX_ID);
+    wr.Write(LFIX_VERSION);
+    wr.Write(uint64(fs::file_size(archivePath)));
+    wr.Write(int64(
+        fs::last_write_time(archivePath).time_since_epoch().count()));
+    wr.Write(uint32(files.size()));
+
+    for (auto &f : files) {
+      f.Write(wr);
+    }
+  }
+
+private:
+  void BuildNames() {
+    for (size_t i = 0; i < files.size(); i++) {
+      names.emplace(files[i].name, i);
+    }
+  }
+};
+
+// With useCache, index is loaded from (or saved into) <archivePath>.idx
+// Headers are scanned from mapped view, when given
+inline LooseFilesIndex LoadLooseFilesIndex(BinReaderRef rd,
+                                           const std::string &archivePath,
+                                           bool useCache,
+                                           std::string_view mapped = {}) {
+  auto startTime = std::chrono::steady_clock::now();
+  LooseFilesIndex retVal;
+  bool cached = useCache && retVal.LoadCache(archivePath);
+
+  if (!cached) {
+    retVal = mapped.empty() ? LooseFilesIndex(rd) : LooseFilesIndex(mapped);
+
+    if (useCache) {
+      retVal.SaveCache(archivePath);
+    }
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  PrintInfo(cached ? "Loaded " : "Indexed ", retVal.files.size(),
+            " loose files in ", elapsed.count(), "s");
+
+  return retVal;
+}
+
+// Walks headers only until name ending with suffix, rd is left at its data.
+// For single lookups without index cache.
+inline std::optional<LooseFile> FindLooseFile(BinReaderRef rd,
+                                              std::string_view suffix) {
+  const size_t filesSize = rd.GetSize();
+
+  while (rd.Tell() < filesSize) {
+    LooseFile file;
+    file.ReadHeader(rd);
+
+    if (std::string_view(file.name).ends_with(suffix)) {
+      return file;
+    }
+
+    rd.Skip(file.size);
+    rd.ApplyPadding(16);
+  }
+
+  return std::nullopt;
+}
@@ -0,0 +1,101 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include <cassert>
+#include <string>
+#include <vector>
+
+struct LuaFile {
+  uint32 id0;
+  uint32 id1;
+  uint32 offset;
+  uint32 compressedSize;
+  uint32 uncompressedSize;
+};
+
+struct LuaFile_ : LuaFile {
+  void Read(BinReaderRef rd) {
+    rd.Read<LuaFile>(*this);
+    uint8 null;
+    rd.Read(null);
+    assert(null < 2);
+  }
+};
+
+static constexpr uint32 LUA_ID = CompileFourCC("\x1BLua");
+
+struct Lua {
+  uint32 id;
+  uint8 version;
+  uint8 format;
+  uint8 endian;
+  uint8 intSize;
+  uint8 size_tSize;
+  uint8 instructionSize;
+  uint8 numberSize;
+  uint8 internalFlag;
+};
+
+// Reads luap table, rd is switched into archive's endianness
+inline std::vector<LuaFile_> LoadLuaPack(BinReaderRef &rd) {
+  rd.Push();
+  uint32 numFiles;
+  rd.Read(numFiles);
+  rd.Pop();
+
+  if (numFiles > 0x1000) {
+    FByteswapper(numFiles);
+
+    if (numFiles > 0x1000) {
+      throw es::InvalidHeaderError(numFiles);
+    }
+    rd.SwapEndian(true);
+  }
+
+  std::vector<LuaFile_> files;
+  rd.ReadContainer(files);
+
+  return files;
+}
+
+// Source path from chunk header of compiled file, starting at scripts folder
+inline std::string LuaSourceName(BinReaderRef rd, const LuaFile &file) {
+  assert(file.compressedSize == file.uncompressedSize);
+  rd.Push();
+  rd.Seek(file.offset);
+  Lua hdr;
+  rd.Read(hdr);
+
+  assert(hdr.id == LUA_ID);
+
+  std::string sourceName;
+  rd.ReadContainer(sourceName);
+  rd.Pop();
+
+  AFileInfo sourcePath(sourceName);
+  auto foundRoot = sourcePath.GetFullPath().find("cripts/");
+
+  if (foundRoot != std::string::npos) {
+    sourceName = sourcePath.GetFullPath().substr(foundRoot - 1);
+  }
+
+  return sourceName;
+}
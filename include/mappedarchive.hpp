@@ -0,0 +1,106 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "memstream.hpp"
+#include "spike/app_context.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include "spike/io/stat.hpp"
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Gives views of stored (uncompressed) archive entries. Working file is
+// memory mapped, so entries are sent into extract context straight from page
+// cache, without read calls and copies into intermediate buffers.
+// Falls back to reading stream, when working file cannot be mapped.
+struct MappedArchive {
+  MappedArchive(AppContext *ctx) : rd(ctx->GetStream()) {
+    try {
+      mappedFile = es::MappedFile(std::string(ctx->workingFile.GetFullPath()));
+      data = {static_cast<const char *>(mappedFile.data), mappedFile.fileSize};
+    } catch (const std::exception &) {
+    }
+  }
+
+  bool Mapped() const { return data.data() != nullptr; }
+
+  // Whole mapped file, empty when not mapped
+  std::string_view View() const { return data; }
+
+  std::string_view Get(size_t offset, size_t size) {
+    if (Mapped() && offset <= data.size() && size <= data.size() - offset) {
+      return data.substr(offset, size);
+    }
+
+    rd.Seek(offset);
+    rd.ReadContainer(buffer, size);
+
+    return buffer;
+  }
+
+  // Reads one byte of every page of view, so pages are loaded by the calling
+  // thread
+  static void Prefault(std::string_view view) {
+    static constexpr size_t PAGE_STRIDE = 0x1000;
+    volatile char sink = 0;
+
+    for (size_t i = 0; i < view.size(); i += PAGE_STRIDE) {
+      sink = view[i];
+    }
+
+    if (!view.empty()) {
+      sink = view.back();
+    }
+
+    (void)sink;
+  }
+
+private:
+  es::MappedFile mappedFile;
+  std::string_view data;
+  BinReaderRef rd;
+  std::string buffer;
+};
+
+// Archive mapped once and read by several workers. Every worker gets its own
+// stream: memory stream over the mapping, so stored entries are sent as views,
+// or file stream when archive cannot be mapped.
+struct SharedMapping {
+  SharedMapping(const std::string &path_) : path(path_) {
+    try {
+      mappedFile = es::MappedFile(path);
+      data = {static_cast<const char *>(mappedFile.data), mappedFile.fileSize};
+    } catch (const std::exception &) {
+    }
+  }
+
+  std::unique_ptr<std::istream> NewStream() const {
+    if (data.data()) {
+      return std::make_unique<MemoryStream>(data);
+    }
+
+    return std::make_unique<std::ifstream>(path, std::ios::binary);
+  }
+
+private:
+  std::string path;
+  es::MappedFile mappedFile;
+  std::string_view data;
+};
@@ -0,0 +1,107 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/app_context.hpp"
+#include "zlib.h"
+#include <stdexcept>
+#include <string>
+
+// Collects output of single file in memory
+struct MemoryExtractContext : AppExtractContext {
+  std::string data;
+
+  void NewFile(const std::string &) override { data.clear(); }
+  void SendData(std::string_view data_) override { data.append(data_); }
+  bool RequiresFolders() const override { return false; }
+  void AddFolderPath(const std::string &) override {}
+  void GenerateFolders() override {}
+};
+
+// Grayscale PNG, rows must be packed to whole bytes
+inline std::string EncodePNG(uint32 width, uint32 height, uint8 bitDepth,
+                             std::string_view pixels) {
+  const size_t rowSize = (size_t(width) * bitDepth + 7) / 8;
+  std::string filtered;
+  filtered.reserve((rowSize + 1) * height);
+
+  for (uint32 r = 0; r < height; r++) {
+    filtered.push_back(0); // no filter
+    filtered.append(pixels.substr(r * rowSize, rowSize));
+  }
+
+  uLongf compSize = compressBound(filtered.size());
+  std::string compressed(compSize, 0);
+
+  if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &compSize,
+                reinterpret_cast<const Bytef *>(filtered.data()),
+                filtered.size(), Z_BEST_SPEED) != Z_OK) {
+    throw std::runtime_error("Failed to compress PNG data");
+  }
+
+  compressed.resize(compSize);
+  std::string retVal("\x89PNG\r\n\x1A\n", 8);
+
+  auto Append32 = [](std::string &str, uint32 value) {
+    for (int32 s = 24; s >= 0; s -= 8) {
+      str.push_back(char(value >> s));
+    }
+  };
+
+  auto Chunk = [&](const char *type, std::string_view data) {
+    std::string body(type, 4);
+    body.append(data);
+    Append32(retVal, data.size());
+    retVal.append(body);
+    Append32(retVal, crc32(0, reinterpret_cast<const Bytef *>(body.data()),
+                           body.size()));
+  };
+
+  std::string header;
+  Append32(header, width);
+  Append32(header, height);
+  header.push_back(bitDepth);
+  header.append(4, 0); // grayscale, deflate, adaptive filter, no interlace
+
+  Chunk("IHDR", header);
+  Chunk("IDAT", compressed);
+  Chunk("IEND", {});
+
+  return retVal;
+}
+
+// Writes inflated mask as PNG, when its size matches dimensions for any of
+// PNG grayscale bit depths, otherwise as raw data with JSON sidecar.
+inline void WriteMaskImage(AppExtractContext *ectx, const std::string &path,
+                           uint32 width, uint32 height, std::string_view data) {
+  for (uint8 bitDepth : {8, 4, 2, 1}) {
+    const size_t rowSize = (size_t(width) * bitDepth + 7) / 8;
+
+    if (width && height && rowSize * height == data.size()) {
+      ectx->NewFile(path + ".png");
+      ectx->SendData(EncodePNG(width, height, bitDepth, data));
+      return;
+    }
+  }
+
+  ectx->NewFile(path + ".raw");
+  ectx->SendData(data);
+  ectx->NewFile(path + ".json");
+  ectx->SendData("{\"width\": " + std::to_string(width) +
+                 ", \"height\": " + std::to_string(height) +
+                 ", \"size\": " + std::to_string(data.size()) + "}\n");
+}
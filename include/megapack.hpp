@@ -15,6 +15,7 @@
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#pragma once
 #include "hashstorage.hpp"
 #include "spike/except.hpp"
 #include <map>
@@ -53,6 +54,7 @@ struct File {
 struct FileRange {
   mutable bool used;
   uint32 offset;
+  uint32 size;
 };
 
 inline std::map<uint32, FileRange> LoadMegaPack(BinReaderRef_e rd) {
@@ -73,7 +75,7 @@ inline std::map<uint32, FileRange> LoadMegaPack(BinReaderRef_e rd) {
   std::map<uint32, FileRange> retVal;
 
   for (auto &f : files) {
-    retVal.emplace(f.id.index, FileRange{false, uint32(f.offset)});
+    retVal.emplace(f.id.index, FileRange{false, uint32(f.offset), f.size});
   }
 
   return retVal;
@@ -0,0 +1,90 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <istream>
+#include <optional>
+#include <streambuf>
+#include <string_view>
+
+// Read only, non owning view, suitable for BinReaderRef
+struct MemoryStreamBuf : std::streambuf {
+  MemoryStreamBuf(std::string_view data) {
+    char *begin = const_cast<char *>(data.data());
+    setg(begin, begin, begin + data.size());
+  }
+
+protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override {
+    if (!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+
+    char *target = gptr();
+
+    if (dir == std::ios_base::beg) {
+      target = eback();
+    } else if (dir == std::ios_base::end) {
+      target = egptr();
+    }
+
+    if (off < eback() - target || off > egptr() - target) {
+      return pos_type(off_type(-1));
+    }
+
+    target += off;
+    setg(eback(), target, egptr());
+
+    return pos_type(target - eback());
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+struct MemoryStream : std::istream {
+  MemoryStream(std::string_view data_)
+      : std::istream(nullptr), buffer(data_), data(data_) {
+    rdbuf(&buffer);
+  }
+
+  MemoryStream(const MemoryStream &) = delete;
+
+  std::string_view View() const { return data; }
+
+private:
+  MemoryStreamBuf buffer;
+  std::string_view data;
+};
+
+// Memory backed streams are read without copying. Returns view of size bytes
+// at current position and skips them, nullopt for other streams.
+inline std::optional<std::string_view> ReadView(std::istream &str,
+                                                size_t size) {
+  auto mem = dynamic_cast<MemoryStream *>(&str);
+
+  if (!mem) {
+    return std::nullopt;
+  }
+
+  const size_t pos = str.tellg();
+  str.seekg(size, std::ios::cur);
+
+  return mem->View().substr(pos, size);
+}
@@ -17,6 +17,7 @@
 
 #pragma once
 #include "compressed.hpp"
+#include "extractplan.hpp"
 #include "spike/except.hpp"
 
 static constexpr uint32 MSHA_ID = CompileFourCC("AHSM");
@@ -50,6 +51,8 @@ std::string ExtractMeshPack(BinReaderRef_e rd, const std::string &curPath,
 
   std::string fileName = curPath + msha.name;
 
+  // Both streams are inflated on calling thread, straight from a view when
+  // rd is memory backed. Callers already spread mesh packs over workers.
   if (msha.compressedSize0) {
     ectx->NewFile(fileName + ".msh");
     const char *mesh = rd.SwappedEndian() ? "HSEM" : "MESH";
@@ -66,3 +69,38 @@ std::string ExtractMeshPack(BinReaderRef_e rd, const std::string &curPath,
 
   return msha.name;
 }
+
+// Walks over mesh pack without reading its streams
+inline std::string SkipMeshPack(BinReaderRef_e rd) {
+  MSHA msha;
+  rd.Read(msha);
+
+  if (msha.id != MSHA_ID) {
+    throw es::InvalidHeaderError(msha.id);
+  }
+
+  rd.Skip(msha.compressedSize0 + msha.compressedSize1);
+
+  return msha.name;
+}
+
+// Adds .msh and .dat streams into plan, walks over mesh pack like SkipMeshPack
+inline void PlanMeshPack(BinReaderRef_e rd, std::string_view folder,
+                         ExtractPlan &plan) {
+  MSHA msha;
+  rd.Read(msha);
+
+  if (msha.id != MSHA_ID) {
+    throw es::InvalidHeaderError(msha.id);
+  }
+
+  if (msha.compressedSize0) {
+    plan.Add(folder, msha.compressedSize0, msha.uncompressedSize0);
+  }
+
+  if (msha.compressedSize1) {
+    plan.Add(folder, msha.compressedSize1, msha.uncompressedSize1);
+  }
+
+  rd.Skip(msha.compressedSize0 + msha.compressedSize1);
+}
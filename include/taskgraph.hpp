@@ -0,0 +1,230 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/master_printer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Dependency graph of tasks, run on all hardware threads. Task is started
+// once all its dependencies are done, running tasks may add more tasks.
+// Every task belongs to a stage, progress of stages is printed periodically
+// and their wall times at the end. Busy time of a stage is the sum of run
+// times of its tasks, which is roughly what running stages one after
+// another on a single thread would take. First exception stops the graph and
+// is rethrown by Run.
+struct TaskGraph {
+  using TaskId = size_t;
+
+  size_t AddStage(const std::string &name) {
+    std::lock_guard lg(mutex);
+    stages.emplace_back().name = name;
+    return stages.size() - 1;
+  }
+
+  TaskId Add(size_t stage, std::function<void()> func,
+             std::initializer_list<TaskId> dependencies = {}) {
+    return Add(stage, std::move(func),
+               std::span<const TaskId>(dependencies.begin(),
+                                       dependencies.size()));
+  }
+
+  TaskId Add(size_t stage, std::function<void()> func,
+             std::span<const TaskId> dependencies) {
+    std::lock_guard lg(mutex);
+    const TaskId id = tasks.size();
+    Task &task = tasks.emplace_back();
+    task.stage = stage;
+    task.func = std::move(func);
+
+    for (TaskId d : dependencies) {
+      if (!tasks.at(d).done) {
+        tasks[d].dependents.emplace_back(id);
+        task.numDependencies++;
+      }
+    }
+
+    stages.at(stage).numTasks++;
+    numPending++;
+
+    if (!task.numDependencies) {
+      ready.emplace_back(id);
+      condition.notify_one();
+    }
+
+    return id;
+  }
+
+  void Run() {
+    startTime = lastReport = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+
+    for (size_t w = 1; w < std::max(1U, std::thread::hardware_concurrency());
+         w++) {
+      workers.emplace_back([this] { Work(); });
+    }
+
+    Work();
+
+    for (auto &w : workers) {
+      w.join();
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    std::string report;
+    char buffer[160];
+    std::chrono::duration<double> busyTime{};
+
+    for (auto &s : stages) {
+      const std::chrono::duration<double> wallTime = s.endTime - s.startTime;
+      snprintf(buffer, sizeof(buffer),
+               "%-16s %10zu tasks %10.3fs %10.3fs busy\n", s.name.c_str(),
+               s.numTasks, s.numTasks ? wallTime.count() : 0,
+               s.busyTime.count());
+      report.append(buffer);
+      busyTime += s.busyTime;
+    }
+
+    const std::chrono::duration<double> wallTime =
+        std::chrono::steady_clock::now() - startTime;
+    snprintf(buffer, sizeof(buffer),
+             "%-16s %10zu tasks %10.3fs %10.3fs busy, %.1fx faster than "
+             "running tasks one after another",
+             "total", tasks.size(), wallTime.count(), busyTime.count(),
+             busyTime / wallTime);
+    report.append(buffer);
+    PrintInfo(report);
+  }
+
+private:
+  struct Task {
+    size_t stage;
+    std::function<void()> func;
+    size_t numDependencies = 0;
+    std::vector<TaskId> dependents;
+    bool done = false;
+  };
+
+  struct Stage {
+    std::string name;
+    size_t numTasks = 0;
+    size_t numDone = 0;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point endTime;
+    std::chrono::duration<double> busyTime{};
+  };
+
+  void Work() {
+    std::unique_lock lk(mutex);
+
+    while (true) {
+      condition.wait(
+          lk, [&] { return !ready.empty() || !numPending || error; });
+
+      if (!numPending || error) {
+        return;
+      }
+
+      const TaskId id = ready.front();
+      ready.pop_front();
+      Stage &stage = stages[tasks[id].stage];
+
+      if (stage.startTime == std::chrono::steady_clock::time_point{}) {
+        stage.startTime = std::chrono::steady_clock::now();
+      }
+
+      std::function<void()> func = std::move(tasks[id].func);
+      lk.unlock();
+      const auto taskStart = std::chrono::steady_clock::now();
+
+      try {
+        func();
+      } catch (...) {
+        lk.lock();
+        if (!error) {
+          error = std::current_exception();
+        }
+        condition.notify_all();
+        return;
+      }
+
+      lk.lock();
+      stage.busyTime += std::chrono::steady_clock::now() - taskStart;
+      Finished(id);
+    }
+  }
+
+  // Called under lock
+  void Finished(TaskId id) {
+    Task &task = tasks[id];
+    task.done = true;
+    Stage &stage = stages[task.stage];
+    stage.numDone++;
+    stage.endTime = std::chrono::steady_clock::now();
+
+    for (TaskId d : task.dependents) {
+      if (!--tasks[d].numDependencies) {
+        ready.emplace_back(d);
+      }
+    }
+
+    numPending--;
+    condition.notify_all();
+
+    if (stage.endTime - lastReport > std::chrono::seconds(1)) {
+      lastReport = stage.endTime;
+      std::string report;
+
+      for (auto &s : stages) {
+        if (s.numTasks) {
+          report.append(s.name)
+              .append(": ")
+              .append(std::to_string(s.numDone))
+              .append("/")
+              .append(std::to_string(s.numTasks))
+              .append("  ");
+        }
+      }
+
+      PrintInfo(report);
+    }
+  }
+
+  // Deque keeps references of running tasks valid, while others are added
+  std::deque<Task> tasks;
+  std::deque<TaskId> ready;
+  std::vector<Stage> stages;
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t numPending = 0;
+  std::exception_ptr error;
+  std::chrono::steady_clock::time_point startTime;
+  std::chrono::steady_clock::time_point lastReport;
+};
@@ -0,0 +1,388 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "fingerprint.hpp"
+#include "francemap.hpp"
+#include "spike/io/binreader_stream.hpp"
+#include "spike/master_printer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+static constexpr uint32 TIDX_ID = CompileFourCC("TIDX");
+static constexpr uint32 TIDX_VERSION = 1;
+
+// Top down rectangle, tiles are laid out on x, z plane
+struct TileBox {
+  float minX = INFINITY;
+  float minZ = INFINITY;
+  float maxX = -INFINITY;
+  float maxZ = -INFINITY;
+
+  static TileBox FromTile(const Tile &tile) {
+    return {tile.bounds[0], tile.bounds[2], tile.bounds[3], tile.bounds[5]};
+  }
+
+  // Format: "minX minZ maxX maxZ", empty string is an infinite box
+  static TileBox FromString(const std::string &str) {
+    if (str.empty()) {
+      return {-INFINITY, -INFINITY, INFINITY, INFINITY};
+    }
+
+    TileBox retVal;
+
+    if (sscanf(str.c_str(), "%f %f %f %f", &retVal.minX, &retVal.minZ,
+               &retVal.maxX, &retVal.maxZ) != 4) {
+      throw std::runtime_error("Invalid region format: " + str);
+    }
+
+    return retVal;
+  }
+
+  void Merge(const TileBox &o) {
+    minX = std::min(minX, o.minX);
+    minZ = std::min(minZ, o.minZ);
+    maxX = std::max(maxX, o.maxX);
+    maxZ = std::max(maxZ, o.maxZ);
+  }
+
+  bool Intersects(const TileBox &o) const {
+    return minX <= o.maxX && o.minX <= maxX && minZ <= o.maxZ &&
+           o.minZ <= maxZ;
+  }
+
+  bool Contains(const TileBox &o) const {
+    return minX <= o.minX && o.maxX <= maxX && minZ <= o.minZ &&
+           o.maxZ <= maxZ;
+  }
+
+  TileBox Quadrant(uint32 q) const {
+    const float midX = (minX + maxX) / 2;
+    const float midZ = (minZ + maxZ) / 2;
+    return {q & 1 ? midX : minX, q & 2 ? midZ : minZ, q & 1 ? maxX : midX,
+            q & 2 ? maxZ : midZ};
+  }
+};
+
+// Format: LOD levels separated by spaces or commas, empty string for all
+inline uint32 TileLodMask(const std::string &str) {
+  uint32 retVal = 0;
+
+  for (char c : str) {
+    if (c >= '0' && c <= '9') {
+      retVal |= 1 << (c - '0');
+    } else if (c != ' ' && c != ',') {
+      throw std::runtime_error("Invalid LOD list: " + str);
+    }
+  }
+
+  return str.empty() ? ~0U : retVal;
+}
+
+// Saved index is reused only for the same tile records
+inline uint64 TileSourceFingerprint(const std::vector<Tile> &mapTiles) {
+  std::string data;
+  auto Append = [&](const auto *item, size_t count) {
+    data.append(reinterpret_cast<const char *>(item), count * sizeof(*item));
+  };
+
+  for (auto &t : mapTiles) {
+    const uint32 numHashes = t.hashes.size();
+    Append(&t.hash, 1);
+    Append(&t.lod, 1);
+    Append(t.bounds, 6);
+    Append(&numHashes, 1);
+    Append(t.hashes.data(), numHashes);
+  }
+
+  return hash::Fingerprint(data);
+}
+
+struct TileRecord {
+  uint32 hash;
+  uint16 lod;
+  uint16 numChildren;
+  int32 parent = -1;
+  uint32 firstChild; // into TileIndex::children
+  TileBox box;
+  float minY;
+  float maxY;
+};
+
+// Quadtree over tile bounds, with LOD hierarchy from Tile::hashes.
+// Tiles are stored in the smallest node, that fully contains them.
+struct TileIndex {
+  static constexpr uint32 MAX_NODE_TILES = 8;
+  static constexpr uint32 MAX_DEPTH = 12;
+
+  struct Node {
+    TileBox box;
+    uint32 firstTile; // into TileIndex::nodeTiles
+    uint32 numTiles;
+    int32 children[4]{-1, -1, -1, -1};
+  };
+
+  std::vector<TileRecord> tiles;
+  std::vector<uint32> children;
+  std::vector<Node> nodes;
+  std::vector<uint32> nodeTiles;
+  uint64 source = 0; // TileSourceFingerprint of map tiles
+
+  TileIndex() = default;
+
+  TileIndex(const std::vector<Tile> &mapTiles)
+      : source(TileSourceFingerprint(mapTiles)) {
+    std::map<uint32, uint32> tileIds;
+
+    for (auto &t : mapTiles) {
+      TileRecord rec{};
+      rec.hash = t.hash;
+      rec.lod = t.lod;
+      rec.parent = -1;
+      rec.box = TileBox::FromTile(t);
+      rec.minY = t.bounds[1];
+      rec.maxY = t.bounds[4];
+      tileIds.emplace(t.hash, tiles.size());
+      tiles.emplace_back(rec);
+    }
+
+    for (size_t i = 0; i < mapTiles.size(); i++) {
+      TileRecord &rec = tiles[i];
+      rec.firstChild = children.size();
+
+      for (uint32 h : mapTiles[i].hashes) {
+        if (auto found = tileIds.find(h); !es::IsEnd(tileIds, found)) {
+          children.emplace_back(found->second);
+          tiles[found->second].parent = i;
+        }
+      }
+
+      rec.numChildren = children.size() - rec.firstChild;
+    }
+
+    TileBox rootBox;
+    std::vector<uint32> all(tiles.size());
+
+    for (uint32 i = 0; i < tiles.size(); i++) {
+      rootBox.Merge(tiles[i].box);
+      all[i] = i;
+    }
+
+    BuildNode(rootBox, std::move(all), 0);
+  }
+
+  // Calls func(const TileRecord &) for tiles intersecting box.
+  // lodMask has a bit set for every accepted LOD level.
+  template <class Func>
+  void Query(const TileBox &box, uint32 lodMask, Func &&func) const {
+    if (nodes.empty()) {
+      return;
+    }
+
+    std::vector<uint32> stack{0};
+
+    while (!stack.empty()) {
+      const Node &node = nodes[stack.back()];
+      stack.pop_back();
+
+      for (uint32 t = 0; t < node.numTiles; t++) {
+        const TileRecord &rec = tiles[nodeTiles[node.firstTile + t]];
+
+        if ((lodMask >> rec.lod & 1) && box.Intersects(rec.box)) {
+          func(rec);
+        }
+      }
+
+      for (int32 c : node.children) {
+        if (c >= 0 && box.Intersects(nodes[c].box)) {
+          stack.push_back(c);
+        }
+      }
+    }
+  }
+
+  /*
+  Persisted as (little endian):
+    uint32 id; // TIDX
+    uint32 version;
+    uint64 source;
+    uint32 numTiles, numChildren, numNodes, numNodeTiles;
+    TileRecord tiles[numTiles];
+    uint32 children[numChildren];
+    Node nodes[numNodes];
+    uint32 nodeTiles[numNodeTiles];
+  */
+  std::string Save() const {
+    std::string retVal;
+    auto Append = [&](const auto *data, size_t count) {
+      retVal.append(reinterpret_cast<const char *>(data),
+                    count * sizeof(*data));
+    };
+
+    const uint32 header[]{TIDX_ID, TIDX_VERSION};
+    const uint32 counts[]{uint32(tiles.size()), uint32(children.size()),
+                          uint32(nodes.size()), uint32(nodeTiles.size())};
+    Append(header, 2);
+    Append(&source, 1);
+    Append(counts, 4);
+    Append(tiles.data(), tiles.size());
+    Append(children.data(), children.size());
+    Append(nodes.data(), nodes.size());
+    Append(nodeTiles.data(), nodeTiles.size());
+
+    return retVal;
+  }
+
+  // Index of other tiles is skipped, truncated or corrupted index is
+  // reported and ignored
+  bool Load(const std::string &path, uint64 expectedSource) {
+    std::ifstream str(path, std::ios::binary);
+
+    if (str.fail()) {
+      return false;
+    }
+
+    try {
+      BinReaderRef rd(str);
+      uint32 header[2];
+      rd.Read(header);
+      rd.Read(source);
+
+      if (header[0] != TIDX_ID || header[1] != TIDX_VERSION ||
+          source != expectedSource) {
+        source = 0;
+        return false;
+      }
+
+      uint32 counts[4];
+      rd.Read(counts);
+      const uint64 tablesSize = uint64(counts[0]) * sizeof(TileRecord) +
+                                uint64(counts[1]) * sizeof(uint32) +
+                                uint64(counts[2]) * sizeof(Node) +
+                                uint64(counts[3]) * sizeof(uint32);
+
+      if (tablesSize > std::filesystem::file_size(path)) {
+        throw std::runtime_error("Truncated index");
+      }
+
+      rd.ReadContainer(tiles, counts[0]);
+      rd.ReadContainer(children, counts[1]);
+      rd.ReadContainer(nodes, counts[2]);
+      rd.ReadContainer(nodeTiles, counts[3]);
+
+      if (str.fail()) {
+        throw std::runtime_error("Truncated index");
+      }
+
+      Validate();
+    } catch (const std::exception &e) {
+      PrintWarning("Ignoring tile index ", path, ": ", e.what());
+      *this = TileIndex{};
+      return false;
+    }
+
+    return true;
+  }
+
+private:
+  // Loaded tables are used for indexing without further checks
+  void Validate() const {
+    auto Check = [](bool valid) {
+      if (!valid) {
+        throw std::runtime_error("Index out of bounds");
+      }
+    };
+
+    for (auto &t : tiles) {
+      Check(uint64(t.firstChild) + t.numChildren <= children.size());
+      Check(t.parent < int32(tiles.size()));
+    }
+
+    for (uint32 c : children) {
+      Check(c < tiles.size());
+    }
+
+    for (auto &n : nodes) {
+      Check(uint64(n.firstTile) + n.numTiles <= nodeTiles.size());
+
+      for (int32 c : n.children) {
+        Check(c < int32(nodes.size()));
+      }
+    }
+
+    for (uint32 t : nodeTiles) {
+      Check(t < tiles.size());
+    }
+  }
+
+  void BuildNode(const TileBox &box, std::vector<uint32> items,
+                 uint32 depth) {
+    const uint32 nodeId = nodes.size();
+    nodes.emplace_back(Node{box, 0, 0});
+    std::vector<uint32> quadrants[4];
+    std::vector<uint32> kept;
+
+    for (uint32 i : items) {
+      uint32 q = 0;
+
+      if (items.size() > MAX_NODE_TILES && depth < MAX_DEPTH) {
+        while (q < 4 && !box.Quadrant(q).Contains(tiles[i].box)) {
+          q++;
+        }
+      } else {
+        q = 4;
+      }
+
+      if (q < 4) {
+        quadrants[q].push_back(i);
+      } else {
+        kept.push_back(i);
+      }
+    }
+
+    nodes[nodeId].firstTile = nodeTiles.size();
+    nodes[nodeId].numTiles = kept.size();
+    nodeTiles.insert(nodeTiles.end(), kept.begin(), kept.end());
+
+    for (uint32 q = 0; q < 4; q++) {
+      if (!quadrants[q].empty()) {
+        const int32 childId = nodes.size();
+        BuildNode(box.Quadrant(q), std::move(quadrants[q]), depth + 1);
+        nodes[nodeId].children[q] = childId;
+      }
+    }
+  }
+};
+
+// Reuses index saved by last run, when it was built from the same tiles
+inline TileIndex LoadTileIndex(const std::string &path,
+                               const std::vector<Tile> &mapTiles) {
+  TileIndex retVal;
+
+  if (retVal.Load(path, TileSourceFingerprint(mapTiles))) {
+    PrintInfo("Loaded tile index of ", retVal.tiles.size(), " tiles");
+    return retVal;
+  }
+
+  return TileIndex(mapTiles);
+}
@@ -0,0 +1,762 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "assetfilter.hpp"
+#include "extractplan.hpp"
+#include "hashstorage.hpp"
+#include "maskimage.hpp"
+#include "memstream.hpp"
+#include "meshpack.hpp"
+#include "spike/io/binwritter_stream.hpp"
+#include "workpool.hpp"
+#include <cassert>
+#include <cstring>
+#include <sstream>
+
+static constexpr uint32 SBLA_ID = CompileFourCC("ALBS");
+static constexpr uint32 SBLA_ID_BE = CompileFourCC("SBLA");
+static constexpr uint32 HEI1_ID = CompileFourCC("1IEH");
+
+// Dynamic packs have SBLA id too, but no metadata (second dword is 0)
+inline bool IsTilePack(std::string_view data) {
+  uint32 header[2]{};
+  memcpy(header, data.data(), std::min(data.size(), sizeof(header)));
+  return (header[0] == SBLA_ID || header[0] == SBLA_ID_BE) && header[1];
+}
+
+struct HeiFile {
+  uint32 hash0;
+  uint32 offset;
+  uint32 size;
+  uint32 uncompressedSize;
+  uint32 null;
+  uint32 hash1;
+};
+
+template <> void FByteswapper(HeiFile &id, bool) {
+  FByteswapper(id.hash0);
+  FByteswapper(id.offset);
+  FByteswapper(id.size);
+  FByteswapper(id.uncompressedSize);
+  FByteswapper(id.hash1);
+}
+
+struct HeightHeader {
+  uint32 id;
+  uint32 numWBlocks;
+  uint32 numHBlocks;
+  float width;
+  float height;
+};
+
+template <> void FByteswapper(HeightHeader &id, bool) {
+  FByteswapper(id.id);
+  FByteswapper(id.numWBlocks);
+  FByteswapper(id.numHBlocks);
+  FByteswapper(id.width);
+  FByteswapper(id.height);
+}
+
+struct HeightMeta {
+  uint32 null0[3];
+  uint32 numMeshes;
+  uint32 numMasks;
+  uint32 numPhys;
+  uint32 numFB;
+  uint32 numPV;
+  uint32 unk2[3];
+  uint32 numLayouts;
+  uint32 null1;
+};
+
+template <> void FByteswapper(HeightMeta &id, bool) {
+  FByteswapper(id.null0[3]);
+  FByteswapper(id.numMeshes);
+  FByteswapper(id.numMasks);
+  FByteswapper(id.numPhys);
+  FByteswapper(id.numFB);
+  FByteswapper(id.numPV);
+  FByteswapper(id.unk2[3]);
+  FByteswapper(id.numLayouts);
+  FByteswapper(id.null1);
+}
+
+struct HeightBlock {
+  uint32 hash;
+  std::vector<uint32> hashes;
+
+  void Read(BinReaderRef_e rd) {
+    rd.Read(hash);
+    rd.ReadContainer(hashes);
+  }
+
+  void Write(BinWritterRef_e wr) const {
+    wr.Write(hash);
+    wr.WriteContainerWCount(hashes);
+  }
+};
+
+struct Height {
+  HeightHeader hdr;
+  std::vector<uint8> data;
+  HeightMeta meta;
+  std::vector<uint32> hashes;
+  std::vector<HeightBlock> blocks;
+
+  void Read(BinReaderRef_e rd) {
+    rd.Read(hdr);
+    if (hdr.id != HEI1_ID) {
+      throw es::InvalidHeaderError(hdr.id);
+    }
+    rd.ReadContainer(data, hdr.numHBlocks * hdr.numWBlocks);
+    rd.Read(meta);
+    rd.ReadContainer(hashes);
+    rd.ReadContainer(blocks);
+
+    assert(meta.null0[0] == 0);
+    assert(meta.null0[1] == 0);
+    // assert(meta.null0[2] == 0);
+    assert(meta.unk2[0] == 0);
+    assert(meta.unk2[1] == 0);
+    assert(meta.unk2[2] == 0);
+    assert(meta.null1 == 0);
+  }
+
+  void Write(BinWritterRef_e wr) const {
+    wr.Write(hdr);
+    wr.WriteContainer(data);
+    wr.Write(meta);
+    wr.WriteContainerWCount(hashes);
+    wr.Write(uint32(blocks.size()));
+
+    for (auto &b : blocks) {
+      b.Write(wr);
+    }
+  }
+};
+
+struct Mask {
+  std::string fileName;
+  uint32 unk0[2]; // width, height
+  uint16 unk1[3];
+  uint32 uncompressedSize;
+  uint32 unk2;
+  uint32 size;
+
+  void Read(BinReaderRef_e rd) {
+    rd.ReadContainer(fileName);
+    rd.Read(unk0);
+    rd.Read(unk1);
+    rd.Read(uncompressedSize);
+    rd.Read(unk2);
+    rd.Read(size);
+  }
+
+  void Write(BinWritterRef_e wr) const {
+    wr.WriteContainerWCount(fileName);
+    wr.Write(unk0);
+    wr.Write(unk1);
+    wr.Write(uncompressedSize);
+    wr.Write(unk2);
+    wr.Write(size);
+  }
+};
+
+struct Meta {
+  uint32 null0[3];
+  uint32 numMeshes;
+  uint32 numTextures;
+  uint32 null1[6];
+  uint32 numLayouts;
+  uint32 null2[3];
+};
+
+template <> void FByteswapper(Meta &id, bool) {
+  FByteswapper(id.null0);
+  FByteswapper(id.numMeshes);
+  FByteswapper(id.numLayouts);
+  FByteswapper(id.null1);
+  FByteswapper(id.numTextures);
+  FByteswapper(id.null2);
+}
+
+enum class TileEntryType : uint8 {
+  Mesh,
+  Phys,
+  Layout,
+  FB,
+  PV,
+  Mask,
+  Texture,
+};
+
+inline const char *TileEntryExtension(TileEntryType type) {
+  switch (type) {
+  case TileEntryType::Mesh:
+    return ".msh";
+  case TileEntryType::Phys:
+    return ".phy";
+  case TileEntryType::Layout:
+    return ".lay";
+  case TileEntryType::FB:
+    return ".fb";
+  case TileEntryType::PV:
+    return ".pv";
+  case TileEntryType::Mask:
+    return ".mask";
+  case TileEntryType::Texture:
+    return ".dtex";
+  }
+
+  return ".dat";
+}
+
+inline AssetType TileAssetType(TileEntryType type) {
+  switch (type) {
+  case TileEntryType::Mesh:
+    return AssetType::Mesh;
+  case TileEntryType::Phys:
+    return AssetType::Phys;
+  case TileEntryType::Layout:
+    return AssetType::Layout;
+  case TileEntryType::FB:
+    return AssetType::FB;
+  case TileEntryType::PV:
+    return AssetType::PV;
+  case TileEntryType::Mask:
+    return AssetType::Mask;
+  default:
+    return AssetType::Texture;
+  }
+}
+
+struct TileEntry {
+  TileEntryType type;
+  uint32 hash;
+  // Absolute stream offset of entry, including MSHA or Mask header
+  uint32 offset;
+  // Entry span, including MSHA or Mask header
+  uint32 size;
+  uint32 uncompressedSize;
+  // Embedded name for meshes and masks
+  std::string name;
+  // Original table record
+  HeiFile table;
+
+  std::string FileName() const {
+    if (name.empty()) {
+      return std::to_string(hash::GetStringHash(hash)) +
+             TileEntryExtension(type);
+    }
+
+    return name + TileEntryExtension(type);
+  }
+};
+
+struct TilePackIndex {
+  bool swappedEndian = false;
+  bool heightPack = false;
+  // Absolute stream offsets of pack and its first entry
+  uint32 offset;
+  uint32 dataOffset;
+  int32 metaSize;
+  Height height;
+  Meta meta;
+  std::vector<TileEntry> entries;
+};
+
+// Reads header and tables, entries get only type and table record
+inline TilePackIndex ReadTilePackTables(BinReaderRef_e rd) {
+  TilePackIndex retVal;
+  retVal.offset = rd.Tell();
+  uint32 id;
+  rd.Read(id);
+
+  if (id != SBLA_ID) {
+    if (id == SBLA_ID_BE) {
+      rd.SwapEndian(true);
+    } else {
+      throw es::InvalidHeaderError(id);
+    }
+  }
+
+  int32 &metaSize = retVal.metaSize;
+  rd.Read(metaSize);
+
+  if (metaSize < 1) {
+    throw std::runtime_error("Expected metadata");
+  }
+
+  retVal.swappedEndian = rd.SwappedEndian();
+
+  auto AddFiles = [&](TileEntryType type, size_t numItems) {
+    std::vector<HeiFile> items;
+    rd.ReadContainer(items, numItems);
+
+    for (auto &i : items) {
+      TileEntry &entry = retVal.entries.emplace_back();
+      entry.type = type;
+      entry.hash = i.hash0;
+      entry.uncompressedSize = i.uncompressedSize;
+      entry.table = i;
+    }
+  };
+
+  // Tables follow HEI1 data, or Meta at the same offset
+  const size_t metaOffset = rd.Tell();
+
+  try {
+    rd.Read(retVal.height);
+    retVal.heightPack = true;
+    const HeightMeta &meta = retVal.height.meta;
+    AddFiles(TileEntryType::Mesh, meta.numMeshes);
+    AddFiles(TileEntryType::Phys, meta.numPhys);
+    AddFiles(TileEntryType::Layout, meta.numLayouts);
+    AddFiles(TileEntryType::FB, meta.numFB);
+    AddFiles(TileEntryType::PV, meta.numPV);
+    AddFiles(TileEntryType::Mask, meta.numMasks);
+  } catch (const es::InvalidHeaderError &e) {
+    if (metaSize != 0x3c) {
+      throw std::runtime_error("Unknown pack type.");
+    }
+    rd.Seek(metaOffset);
+
+    Meta &meta = retVal.meta;
+    rd.Read(meta);
+
+    assert(meta.null0[0] == 0);
+    assert(meta.null0[1] == 0);
+    assert(meta.null0[2] == 0);
+    assert(meta.null1[0] == 0);
+    assert(meta.null1[1] == 0);
+    assert(meta.null1[2] == 0);
+    assert(meta.null1[3] == 0);
+    assert(meta.null1[4] == 0);
+    assert(meta.null1[5] == 0);
+    assert(meta.null2[0] == 0);
+    assert(meta.null2[1] == 0);
+    assert(meta.null2[2] == 0);
+
+    AddFiles(TileEntryType::Mesh, meta.numMeshes);
+    AddFiles(TileEntryType::Layout, meta.numLayouts);
+    AddFiles(TileEntryType::Texture, meta.numTextures);
+  }
+
+  retVal.dataOffset = rd.Tell();
+
+  return retVal;
+}
+
+// Reads tables and walks entry headers, payloads are only skipped
+inline TilePackIndex IndexTilePack(BinReaderRef_e rd) {
+  TilePackIndex retVal = ReadTilePackTables(rd);
+  rd.SwapEndian(retVal.swappedEndian);
+
+  for (auto &entry : retVal.entries) {
+    const HeiFile &f = entry.table;
+    entry.offset = rd.Tell();
+
+    switch (entry.type) {
+    case TileEntryType::Mesh: {
+      MSHA msha;
+      rd.Read(msha);
+
+      if (msha.id != MSHA_ID) {
+        throw es::InvalidHeaderError(msha.id);
+      }
+
+      entry.name = msha.name;
+      entry.uncompressedSize = msha.uncompressedSize0 + msha.uncompressedSize1;
+      rd.Skip(msha.compressedSize0 + msha.compressedSize1);
+      break;
+    }
+    case TileEntryType::Mask: {
+      Mask mask;
+      rd.Read(mask);
+      entry.name = mask.fileName;
+      entry.uncompressedSize = mask.uncompressedSize;
+      rd.Skip(mask.size);
+      break;
+    }
+    case TileEntryType::Layout:
+      entry.hash = f.hash1 ? f.hash1 : f.hash0;
+      rd.Skip(f.size);
+      break;
+    default:
+      rd.Skip(f.size);
+      break;
+    }
+
+    entry.size = rd.Tell() - entry.offset;
+  }
+
+  return retVal;
+}
+
+// Registers embedded names of meshes and masks, so names of other entries
+// don't depend on order in which entries are extracted
+inline void RegisterTilePackNames(const TilePackIndex &index) {
+  for (auto &e : index.entries) {
+    if (!e.name.empty()) {
+      hash::GetStringHash(e.hash, e.name);
+    }
+  }
+}
+
+// With maskImages, masks are converted into images from inflated buffer
+inline void ExtractTileEntry(BinReaderRef_e rd, const TileEntry &entry,
+                             const std::string &curPath,
+                             AppExtractContext *ectx, std::string &inBuffer,
+                             std::string &outBuffer, bool maskImages = false) {
+  rd.Seek(entry.offset);
+
+  switch (entry.type) {
+  case TileEntryType::Mesh: {
+    auto mName = ExtractMeshPack(rd, curPath, ectx, inBuffer, outBuffer);
+    hash::GetStringHash(entry.hash, mName);
+    break;
+  }
+  case TileEntryType::Mask: {
+    Mask mask;
+    rd.Read(mask);
+    hash::GetStringHash(entry.hash, mask.fileName);
+
+    if (maskImages) {
+      MemoryExtractContext mctx;
+      Extract(&mctx, mask.size, mask.uncompressedSize, inBuffer, outBuffer,
+              rd);
+      WriteMaskImage(ectx, curPath + mask.fileName, mask.unk0[0],
+                     mask.unk0[1], mctx.data);
+      break;
+    }
+
+    ectx->NewFile(curPath + mask.fileName + ".mask");
+    Extract(ectx, mask.size, mask.uncompressedSize, inBuffer, outBuffer, rd);
+    break;
+  }
+  case TileEntryType::Texture: {
+    if (!entry.size) {
+      break;
+    }
+
+    ectx->NewFile(curPath + entry.FileName());
+    ectx->SendData(rd.SwappedEndian() ? "XETD" : "DTEX");
+
+    if (auto view = ReadView(rd.BaseStream(), entry.size)) {
+      ectx->SendData(*view);
+    } else {
+      rd.ReadContainer(inBuffer, entry.size);
+      ectx->SendData(inBuffer);
+    }
+    break;
+  }
+  default:
+    ectx->NewFile(curPath + entry.FileName());
+    Extract(ectx, entry.size, entry.uncompressedSize, inBuffer, outBuffer, rd);
+    break;
+  }
+}
+
+// Entries rejected by filter are never read, they are skipped by index
+// Without parallelMasks, mask images are converted on calling thread, for
+// callers that already run packs on a pool
+inline void ExtractTilePack(BinReaderRef_e rd, const std::string &curPath,
+                            AppExtractContext *ectx, bool maskImages = false,
+                            const AssetFilter &filter = {},
+                            bool parallelMasks = true) {
+  const TilePackIndex index = IndexTilePack(rd);
+  rd.SwapEndian(index.swappedEndian);
+  std::string inBuffer;
+  std::string outBuffer;
+  std::vector<std::pair<const TileEntry *, std::string>> masks;
+
+  for (auto &e : index.entries) {
+    if (!filter.Accepts(TileAssetType(e.type))) {
+      continue;
+    }
+
+    if (maskImages && parallelMasks && e.type == TileEntryType::Mask) {
+      // Only compressed data is loaded here, decoding is done in batch
+      rd.Seek(e.offset);
+      rd.ReadContainer(masks.emplace_back(&e, std::string{}).second, e.size);
+      continue;
+    }
+
+    ExtractTileEntry(rd, e, curPath, ectx, inBuffer, outBuffer, maskImages);
+  }
+
+  std::mutex ectxMutex;
+
+  RunParallel(masks.size(), [&](size_t i) {
+    TileEntry entry = *masks[i].first;
+    entry.offset = 0;
+    MemoryStream maskStream(masks[i].second);
+    BinReaderRef_e maskRd(maskStream);
+    maskRd.SwapEndian(index.swappedEndian);
+    BufferedExtractContext bctx(ectx);
+    std::string inBuffer;
+    std::string outBuffer;
+    ExtractTileEntry(maskRd, entry, curPath, &bctx, inBuffer, outBuffer, true);
+    bctx.Flush(ectxMutex);
+  });
+}
+
+// Every entry is inflated by a worker from its own view of packData
+inline void ExtractTilePackParallel(std::string_view packData,
+                                    const std::string &curPath,
+                                    AppExtractContext *ectx,
+                                    bool maskImages = false,
+                                    const AssetFilter &filter = {}) {
+  MemoryStream packStream(packData);
+  TilePackIndex index = IndexTilePack(packStream);
+  std::erase_if(index.entries, [&](const TileEntry &e) {
+    return !filter.Accepts(TileAssetType(e.type));
+  });
+  // Names are registered before workers start, so entries resolving them
+  // don't depend on which worker finishes first
+  RegisterTilePackNames(index);
+  std::mutex ectxMutex;
+
+  RunParallel(index.entries.size(), [&](size_t i) {
+    MemoryStream entryStream(packData);
+    BinReaderRef_e entryRd(entryStream);
+    entryRd.SwapEndian(index.swappedEndian);
+    BufferedExtractContext bctx(ectx);
+    std::string inBuffer;
+    std::string outBuffer;
+    ExtractTileEntry(entryRd, index.entries.at(i), curPath, &bctx, inBuffer,
+                     outBuffer, maskImages);
+    bctx.Flush(ectxMutex);
+  });
+}
+
+// Adds entries into plan from tables and mesh headers
+inline void PlanTilePack(BinReaderRef_e rd, const std::string &curPath,
+                         ExtractPlan &plan, const AssetFilter &filter = {}) {
+  const TilePackIndex index = ReadTilePackTables(rd);
+  rd.SwapEndian(index.swappedEndian);
+
+  for (auto &e : index.entries) {
+    if (!filter.Accepts(TileAssetType(e.type))) {
+      continue;
+    }
+
+    // Meshes come first, their headers tell whether .msh and .dat are written
+    if (e.type == TileEntryType::Mesh) {
+      PlanMeshPack(rd, curPath, plan);
+      continue;
+    }
+
+    if (!e.table.size) {
+      continue;
+    }
+
+    // Textures are stored
+    plan.Add(curPath, e.table.size,
+             e.type == TileEntryType::Texture ? e.table.size
+                                              : e.uncompressedSize);
+  }
+}
+
+static constexpr uint32 TPMT_ID = CompileFourCC("TPMT");
+
+enum class TileCompression : uint8 {
+  Stored,
+  Zlib,
+  SEGS,
+};
+
+struct TileStreamMeta {
+  TileCompression compression = TileCompression::Stored;
+  uint16 segsVersion = 0;
+  // Extracted file, empty for streams, that were not written
+  std::string fileName;
+
+  void Read(BinReaderRef rd) {
+    rd.Read(compression);
+    rd.Read(segsVersion);
+    rd.ReadContainer(fileName);
+  }
+
+  void Write(BinWritterRef wr) const {
+    wr.Write(compression);
+    wr.Write(segsVersion);
+    wr.WriteContainerWCount(fileName);
+  }
+};
+
+// Table fields are stored as difference from real entry values,
+// so they can be recalculated, whatever they are relative to.
+struct TileEntryMeta {
+  TileEntryType type;
+  int32 offsetBias;
+  int32 sizeBias;
+  int32 uncompressedBias;
+  std::vector<TileStreamMeta> streams;
+  Mask mask;
+  std::string meshName;
+
+  void Read(BinReaderRef rd) {
+    rd.Read(type);
+    rd.Read(offsetBias);
+    rd.Read(sizeBias);
+    rd.Read(uncompressedBias);
+    rd.ReadContainer(streams);
+
+    if (type == TileEntryType::Mask) {
+      rd.Read(mask);
+    } else if (type == TileEntryType::Mesh) {
+      rd.ReadContainer(meshName);
+    }
+  }
+
+  void Write(BinWritterRef wr) const {
+    wr.Write(type);
+    wr.Write(offsetBias);
+    wr.Write(sizeBias);
+    wr.Write(uncompressedBias);
+    wr.Write(uint32(streams.size()));
+
+    for (auto &s : streams) {
+      s.Write(wr);
+    }
+
+    if (type == TileEntryType::Mask) {
+      mask.Write(wr);
+    } else if (type == TileEntryType::Mesh) {
+      wr.WriteContainerWCount(meshName);
+    }
+  }
+};
+
+/*
+Rebuild info of extracted tile pack (sbla.meta), always little endian
+  uint32 id; // TPMT
+  uint32 headerSize;
+  char header[headerSize]; // Original pack up to first entry
+  uint32 numEntries;
+  TileEntryMeta entries[numEntries];
+*/
+struct TilePackMeta {
+  std::string header;
+  std::vector<TileEntryMeta> entries;
+
+  void Read(BinReaderRef rd) {
+    uint32 id;
+    rd.Read(id);
+
+    if (id != TPMT_ID) {
+      throw es::InvalidHeaderError(id);
+    }
+
+    rd.ReadContainer(header);
+    rd.ReadContainer(entries);
+  }
+
+  std::string Save() const {
+    std::stringstream str;
+    BinWritterRef wr(str);
+    wr.Write(TPMT_ID);
+    wr.WriteContainerWCount(header);
+    wr.Write(uint32(entries.size()));
+
+    for (auto &e : entries) {
+      e.Write(wr);
+    }
+
+    return std::move(str).str();
+  }
+};
+
+// Collects everything, that extracted files don't hold.
+// Must be called after extraction, so file names are resolved the same way.
+inline TilePackMeta MakeTilePackMeta(BinReaderRef_e rd,
+                                     const TilePackIndex &index,
+                                     const std::string &curPath) {
+  rd.SwapEndian(index.swappedEndian);
+  TilePackMeta retVal;
+  rd.Seek(index.offset);
+  rd.ReadContainer(retVal.header, index.dataOffset - index.offset);
+
+  auto Stream = [&](uint32 compSize, uint32 uncompSize, std::string fileName) {
+    TileStreamMeta retVal;
+
+    if (!compSize) {
+      return retVal;
+    }
+
+    retVal.fileName = std::move(fileName);
+    rd.Push();
+    SEGS segs;
+    rd.Read(segs);
+    rd.Pop();
+
+    if (segs.id == CompileFourCC("sges")) {
+      retVal.compression = TileCompression::SEGS;
+      retVal.segsVersion = segs.version;
+    } else if (compSize != uncompSize) {
+      retVal.compression = TileCompression::Zlib;
+    }
+
+    return retVal;
+  };
+
+  for (auto &e : index.entries) {
+    TileEntryMeta &meta = retVal.entries.emplace_back();
+    meta.type = e.type;
+    meta.offsetBias = e.table.offset - (e.offset - index.offset);
+    meta.sizeBias = e.table.size - e.size;
+    meta.uncompressedBias = e.table.uncompressedSize - e.uncompressedSize;
+    rd.Seek(e.offset);
+
+    switch (e.type) {
+    case TileEntryType::Mesh: {
+      MSHA msha;
+      rd.Read(msha);
+      meta.meshName = msha.name;
+      const std::string fileName = curPath + msha.name;
+      meta.streams.emplace_back(Stream(msha.compressedSize0,
+                                       msha.uncompressedSize0,
+                                       fileName + ".msh"));
+      rd.Skip(msha.compressedSize0);
+      meta.streams.emplace_back(Stream(msha.compressedSize1,
+                                       msha.uncompressedSize1,
+                                       fileName + ".dat"));
+      break;
+    }
+    case TileEntryType::Mask:
+      rd.Read(meta.mask);
+      meta.streams.emplace_back(Stream(meta.mask.size,
+                                       meta.mask.uncompressedSize,
+                                       curPath + meta.mask.fileName + ".mask"));
+      break;
+    case TileEntryType::Texture:
+      // Stored with DTEX prefix
+      if (e.size) {
+        meta.streams.emplace_back().fileName = curPath + e.FileName();
+      }
+      break;
+    default:
+      meta.streams.emplace_back(
+          Stream(e.size, e.uncompressedSize, curPath + e.FileName()));
+      break;
+    }
+  }
+
+  return retVal;
+}
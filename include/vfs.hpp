@@ -0,0 +1,565 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "assetcatalog.hpp"
+#include "compressed.hpp"
+#include "installcatalog.hpp"
+#include "installindex.hpp"
+#include "memstream.hpp"
+#include "meshpack.hpp"
+#include "spike/except.hpp"
+#include "spike/io/stat.hpp"
+#include "spike/master_printer.hpp"
+#include "tilepack.hpp"
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+
+static constexpr size_t VFS_DEFAULT_CACHE_SIZE = 64 << 20;
+
+enum class VFSCodec : uint8 {
+  Stored,
+  Zlib,
+  Deflate, // SEGS chunk
+};
+
+// Range of file, that is decoded as whole
+struct VFSBlock {
+  uint64 offset; // in file, without prefix
+  uint32 size;   // uncompressed
+  uint64 source; // absolute offset in archive
+  uint32 sourceSize;
+  VFSCodec codec;
+};
+
+struct VFSStat {
+  std::string path;
+  bool file = false;
+  // Tile packs and cinpacks are both files and directories
+  bool directory = false;
+  uint64 size = 0;
+  const CatalogRecord *record = nullptr;
+};
+
+struct VirtualFileSystem;
+
+// Opened file, only headers and SEGS tables are read by Open.
+// Decoded blocks are shared with other files through cache of filesystem.
+struct VFSFile {
+  uint64 Size() const { return prefix.size() + streamSize; }
+
+  std::span<const VFSBlock> Blocks() const { return blocks; }
+
+  // Returns number of copied bytes, that is less than size only at end of
+  // file
+  size_t Read(uint64 offset, char *buffer, size_t size) const;
+
+  std::string ReadAll() const {
+    std::string retVal(Size(), 0);
+    retVal.resize(Read(0, retVal.data(), retVal.size()));
+    return retVal;
+  }
+
+private:
+  friend struct VirtualFileSystem;
+  const VirtualFileSystem *vfs;
+  std::string_view archive;
+  uint64 key;
+  // Magic, that is written by extraction before stream (MESH, DTEX)
+  std::string prefix;
+  uint64 streamSize = 0;
+  std::vector<VFSBlock> blocks;
+};
+
+// Lowercase path with forward slashes and without leading or trailing
+// slashes
+inline std::string VFSKey(std::string_view path) {
+  std::string retVal = ToLower(path);
+  std::replace(retVal.begin(), retVal.end(), '\\', '/');
+  const size_t begin = retVal.find_first_not_of('/');
+
+  if (begin == retVal.npos) {
+    return {};
+  }
+
+  retVal.erase(0, begin);
+
+  while (retVal.ends_with('/')) {
+    retVal.pop_back();
+  }
+
+  return retVal;
+}
+
+// Read only filesystem over archives of install folder. Virtual paths are
+// archive paths followed by catalog names, for example
+// "mega0.megapack/1234/rock.msh". Paths are case insensitive.
+// Mesh records give two files, like extraction does: .msh and .dat.
+// Archives are mapped, stored files are read straight from mapping,
+// compressed files are inflated on read by blocks (SEGS chunks or whole
+// zlib stream) and kept in LRU cache of cacheSize bytes.
+// All methods can be called from more threads.
+struct VirtualFileSystem {
+  // Uses assets.catalog of install folder, when it is newer than archives,
+  // otherwise archives are cataloged in memory
+  VirtualFileSystem(const std::string &root,
+                    size_t cacheSize_ = VFS_DEFAULT_CACHE_SIZE)
+      : cacheSize(cacheSize_) {
+    namespace fs = std::filesystem;
+    const InstallIndex install(root);
+    fs::path base = root;
+
+    if (auto path = install.Find("assets.catalog")) {
+      try {
+        catalog.emplace(path->string());
+        base = path->parent_path();
+
+        if (!CatalogUpToDate(*path)) {
+          PrintWarning(path->string(), " is older than archives, ignored");
+          catalog.reset();
+        }
+      } catch (const std::exception &e) {
+        PrintWarning("Cannot use ", path->string(), ": ", e.what());
+        catalog.reset();
+      }
+    }
+
+    if (!catalog) {
+      base = root;
+      catalog.emplace(BuildInstallCatalog(install, root));
+    }
+
+    for (size_t a = 0; a < catalog->NumArchives(); a++) {
+      const fs::path path = base / catalog->Archive(a);
+      es::MappedFile &mapped = archives.emplace_back();
+
+      try {
+        mapped = es::MappedFile(path.string());
+        archiveData.emplace_back(static_cast<const char *>(mapped.data),
+                                 mapped.fileSize);
+      } catch (const std::exception &e) {
+        PrintWarning("Cannot map ", path.string(), ": ", e.what());
+        archiveData.emplace_back();
+      }
+    }
+
+    const std::span<const CatalogRecord> records = catalog->Records();
+
+    for (uint32 i = 0; i < records.size(); i++) {
+      const CatalogRecord &r = records[i];
+      std::string path(catalog->Archive(r));
+      path.append("/").append(catalog->Name(r));
+      std::replace(path.begin(), path.end(), '\\', '/');
+
+      if (r.type == CatalogType::Mesh && path.ends_with(".msh")) {
+        std::string dataPath = path.substr(0, path.size() - 4) + ".dat";
+        nodes.emplace_back(Node{VFSKey(dataPath), std::move(dataPath), i, 1});
+      }
+
+      nodes.emplace_back(Node{VFSKey(path), std::move(path), i, 0});
+    }
+
+    std::stable_sort(nodes.begin(), nodes.end(),
+                     [](auto &n0, auto &n1) { return n0.key < n1.key; });
+  }
+
+  const AssetCatalog &Catalog() const { return *catalog; }
+
+  // Throws es::FileNotFoundError
+  VFSFile Open(std::string_view path) const {
+    const Node *node = Find(VFSKey(path));
+
+    if (!node) {
+      throw es::FileNotFoundError(std::string(path));
+    }
+
+    return OpenNode(*node);
+  }
+
+  std::optional<VFSStat> Stat(std::string_view path) const {
+    const std::string key = VFSKey(path);
+    VFSStat retVal;
+    retVal.path = key;
+    retVal.directory = key.empty() || HasChildren(key);
+
+    if (const Node *node = Find(key)) {
+      try {
+        retVal.size = OpenNode(*node).Size();
+        retVal.file = true;
+        retVal.path = node->path;
+        retVal.record = &catalog->Records()[node->record];
+      } catch (const es::FileNotFoundError &) {
+      }
+    }
+
+    if (!retVal.file && !retVal.directory) {
+      return std::nullopt;
+    }
+
+    return retVal;
+  }
+
+  // Direct children of directory, sorted by path.
+  // Throws es::FileNotFoundError, when path doesn't exist.
+  std::vector<VFSStat> List(std::string_view path) const {
+    const std::string key = VFSKey(path);
+    const std::string prefix = key.empty() ? key : key + '/';
+    std::map<std::string, VFSStat> children;
+
+    for (auto it = LowerBound(prefix);
+         it != nodes.end() && it->key.starts_with(prefix); it++) {
+      const size_t slash = it->key.find('/', prefix.size());
+      VFSStat &child = children[it->key.substr(0, slash)];
+
+      if (slash != it->key.npos) {
+        child.directory = true;
+
+        if (!child.file) {
+          child.path = it->path.substr(0, slash);
+        }
+
+        // Skip rest of subtree, its keys are below "child0"
+        it = std::prev(LowerBound(it->key.substr(0, slash) + '0'));
+        continue;
+      }
+
+      if (child.file) {
+        continue;
+      }
+
+      try {
+        child.size = OpenNode(*it).Size();
+        child.file = true;
+        child.path = it->path;
+        child.record = &catalog->Records()[it->record];
+      } catch (const es::FileNotFoundError &) {
+        if (!child.directory) {
+          children.erase(it->key);
+        }
+      }
+    }
+
+    if (children.empty() && !Stat(key)) {
+      throw es::FileNotFoundError(std::string(path));
+    }
+
+    std::vector<VFSStat> retVal;
+    retVal.reserve(children.size());
+
+    for (auto &[_, c] : children) {
+      retVal.emplace_back(std::move(c));
+    }
+
+    return retVal;
+  }
+
+private:
+  friend struct VFSFile;
+
+  struct Node {
+    std::string key;
+    std::string path;
+    uint32 record;
+    // 1 for .dat stream of mesh
+    uint8 stream;
+  };
+
+  bool CatalogUpToDate(const std::filesystem::path &catalogPath) const {
+    namespace fs = std::filesystem;
+    const auto catalogTime = fs::last_write_time(catalogPath);
+
+    for (size_t a = 0; a < catalog->NumArchives(); a++) {
+      const fs::path path = catalogPath.parent_path() / catalog->Archive(a);
+      std::error_code ec;
+
+      if (fs::last_write_time(path, ec) > catalogTime || ec) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  std::vector<Node>::const_iterator LowerBound(std::string_view key) const {
+    return std::lower_bound(
+        nodes.begin(), nodes.end(), key,
+        [](const Node &n, std::string_view k) { return n.key < k; });
+  }
+
+  const Node *Find(std::string_view key) const {
+    auto found = LowerBound(key);
+
+    if (found == nodes.end() || found->key != key) {
+      return nullptr;
+    }
+
+    return &*found;
+  }
+
+  bool HasChildren(const std::string &key) const {
+    const std::string prefix = key + '/';
+    auto found = LowerBound(prefix);
+
+    return found != nodes.end() && found->key.starts_with(prefix);
+  }
+
+  // Stream of tile entry might be split into SEGS chunks
+  static void AddStream(VFSFile &file, uint64 offset, uint32 compSize,
+                        uint32 uncompSize, bool swapped, bool tileStream) {
+    const std::string_view stream =
+        CatalogSubView(file.archive, offset, compSize);
+
+    if (tileStream && compSize >= sizeof(SEGS)) {
+      MemoryStream segsStream(stream);
+      BinReaderRef_e rd(segsStream);
+      rd.SwapEndian(swapped);
+      SEGS hdr;
+      rd.Read(hdr);
+
+      if (hdr.id == CompileFourCC("sges")) {
+        std::vector<SEGSChunk> chunks;
+        rd.ReadContainer(chunks, hdr.numChunks);
+
+        for (auto &c : chunks) {
+          if (!c.offset) {
+            throw std::runtime_error("Invalid SEGS chunk offset");
+          }
+
+          CatalogSubView(stream, c.offset - 1, c.compressedSize);
+          const uint32 size =
+              c.uncompressedSize == 0 ? 0x10000 : c.uncompressedSize;
+          file.blocks.emplace_back(VFSBlock{file.streamSize, size,
+                                            offset + c.offset - 1,
+                                            c.compressedSize,
+                                            VFSCodec::Deflate});
+          file.streamSize += size;
+        }
+
+        return;
+      }
+    }
+
+    if (!compSize) {
+      return;
+    }
+
+    file.blocks.emplace_back(VFSBlock{
+        0, uncompSize, offset, compSize,
+        compSize == uncompSize ? VFSCodec::Stored : VFSCodec::Zlib});
+    file.streamSize = uncompSize;
+  }
+
+  std::string_view ArchiveData(const CatalogRecord &record) const {
+    const std::string_view data = archiveData.at(record.archive);
+
+    if (!data.data()) {
+      throw std::runtime_error("Archive not mapped: " +
+                               std::string(catalog->Archive(record)));
+    }
+
+    return data;
+  }
+
+  VFSFile OpenNode(const Node &node) const {
+    const CatalogRecord &record = catalog->Records()[node.record];
+    VFSFile retVal;
+    retVal.vfs = this;
+    retVal.archive = ArchiveData(record);
+    retVal.key = (uint64(node.record) << 17) | (uint64(node.stream) << 16);
+
+    if (record.type < CatalogType::Mesh || record.type > CatalogType::Texture) {
+      AddStream(retVal, record.offset, record.compressedSize,
+                record.uncompressedSize, false, false);
+      return retVal;
+    }
+
+    const CatalogRecord *pack = catalog->Container(record);
+
+    if (!pack) {
+      throw std::runtime_error("Tile entry without tile pack: " + node.path);
+    }
+
+    uint32 packId;
+    memcpy(&packId, CatalogSubView(retVal.archive, pack->offset, 4).data(), 4);
+    const bool swapped = packId == SBLA_ID_BE;
+    MemoryStream entryStream(CatalogSubView(retVal.archive, record.offset,
+                                            record.compressedSize));
+    BinReaderRef_e rd(entryStream);
+    rd.SwapEndian(swapped);
+
+    switch (record.type) {
+    case CatalogType::Mesh: {
+      MSHA msha;
+      rd.Read(msha);
+
+      if (msha.id != MSHA_ID) {
+        throw es::InvalidHeaderError(msha.id);
+      }
+
+      const uint64 streamOffset = record.offset + rd.Tell();
+
+      if (node.stream) {
+        if (!msha.compressedSize1) {
+          throw es::FileNotFoundError(node.path);
+        }
+
+        AddStream(retVal, streamOffset + msha.compressedSize0,
+                  msha.compressedSize1, msha.uncompressedSize1, swapped, true);
+        break;
+      }
+
+      if (!msha.compressedSize0) {
+        throw es::FileNotFoundError(node.path);
+      }
+
+      retVal.prefix = swapped ? "HSEM" : "MESH";
+      AddStream(retVal, streamOffset, msha.compressedSize0,
+                msha.uncompressedSize0, swapped, true);
+      break;
+    }
+    case CatalogType::Mask: {
+      Mask mask;
+      rd.Read(mask);
+      AddStream(retVal, record.offset + rd.Tell(), mask.size,
+                mask.uncompressedSize, swapped, true);
+      break;
+    }
+    case CatalogType::Texture:
+      if (!record.compressedSize) {
+        throw es::FileNotFoundError(node.path);
+      }
+
+      retVal.prefix = swapped ? "XETD" : "DTEX";
+      AddStream(retVal, record.offset, record.compressedSize,
+                record.compressedSize, swapped, false);
+      break;
+    default:
+      AddStream(retVal, record.offset, record.compressedSize,
+                record.uncompressedSize, swapped, true);
+      break;
+    }
+
+    return retVal;
+  }
+
+  // Inflates block or gets it from cache. Blocks are decoded outside of
+  // lock, so one block might be decoded by more threads at once.
+  std::shared_ptr<const std::string> Decode(uint64 key, std::string_view data,
+                                            const VFSBlock &block) const {
+    {
+      std::lock_guard lg(cacheMutex);
+      auto found = cacheMap.find(key);
+
+      if (!es::IsEnd(cacheMap, found)) {
+        cacheList.splice(cacheList.begin(), cacheList, found->second);
+        return found->second->second;
+      }
+    }
+
+    auto decoded = std::make_shared<std::string>();
+    Inflate(data.substr(block.source, block.sourceSize), block.size,
+            *decoded,
+            block.codec == VFSCodec::Deflate ? -MAX_WBITS : MAX_WBITS);
+
+    std::lock_guard lg(cacheMutex);
+
+    if (cacheMap.contains(key)) {
+      return decoded;
+    }
+
+    cacheList.emplace_front(key, decoded);
+    cacheMap.emplace(key, cacheList.begin());
+    cacheUsed += decoded->size();
+
+    // Last used block stays, even when it's over the limit
+    while (cacheUsed > cacheSize && cacheList.size() > 1) {
+      cacheUsed -= cacheList.back().second->size();
+      cacheMap.erase(cacheList.back().first);
+      cacheList.pop_back();
+    }
+
+    return decoded;
+  }
+
+  std::optional<AssetCatalog> catalog;
+  std::deque<es::MappedFile> archives;
+  std::vector<std::string_view> archiveData;
+  // Sorted by key
+  std::vector<Node> nodes;
+
+  using CacheItem = std::pair<uint64, std::shared_ptr<const std::string>>;
+  size_t cacheSize;
+  mutable std::mutex cacheMutex;
+  mutable std::list<CacheItem> cacheList; // most recently used first
+  mutable std::unordered_map<uint64, std::list<CacheItem>::iterator> cacheMap;
+  mutable size_t cacheUsed = 0;
+};
+
+inline size_t VFSFile::Read(uint64 offset, char *buffer, size_t size) const {
+  size_t done = 0;
+
+  if (offset < prefix.size()) {
+    done = std::min<uint64>(size, prefix.size() - offset);
+    memcpy(buffer, prefix.data() + offset, done);
+  }
+
+  uint64 pos = offset + done - prefix.size();
+  auto block = std::upper_bound(
+      blocks.begin(), blocks.end(), pos,
+      [](uint64 p, const VFSBlock &b) { return p < b.offset; });
+
+  if (block == blocks.begin()) {
+    return done;
+  }
+
+  for (block--; done < size && block != blocks.end(); block++) {
+    const uint64 inBlock = pos - block->offset;
+    std::shared_ptr<const std::string> decoded;
+    std::string_view data;
+
+    if (block->codec == VFSCodec::Stored) {
+      data = archive.substr(block->source, block->size);
+    } else {
+      decoded = vfs->Decode(key | (block - blocks.begin()), archive, *block);
+      data = *decoded;
+    }
+
+    if (inBlock >= data.size()) {
+      break;
+    }
+
+    const size_t numCopy = std::min<uint64>(size - done, data.size() - inBlock);
+    memcpy(buffer + done, data.data() + inBlock, numCopy);
+    done += numCopy;
+    pos += numCopy;
+
+    // Either request is done, or stream inflated into less than declared
+    if (inBlock + numCopy < block->size) {
+      break;
+    }
+  }
+
+  return done;
+}
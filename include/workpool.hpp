@@ -0,0 +1,149 @@
+/*  SaboteurToolset
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/app_context.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Number of threads RunParallel uses for numItems
+inline size_t NumParallelWorkers(size_t numItems) {
+  return std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()),
+                          numItems);
+}
+
+// Calls func(index) or func(index, workerIndex) for every item, items are
+// handed out to hardware threads one by one. First exception stops handing out
+// and is rethrown.
+template <class Func> void RunParallel(size_t numItems, Func &&func) {
+  const size_t numWorkers = NumParallelWorkers(numItems);
+  std::atomic_size_t nextItem{0};
+  std::exception_ptr error;
+  std::mutex errorMutex;
+
+  auto Work = [&](size_t worker) {
+    for (size_t i; (i = nextItem++) < numItems;) {
+      try {
+        if constexpr (std::is_invocable_v<Func, size_t, size_t>) {
+          func(i, worker);
+        } else {
+          func(i);
+        }
+      } catch (...) {
+        std::lock_guard lg(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        nextItem = numItems;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+
+  for (size_t w = 1; w < numWorkers; w++) {
+    workers.emplace_back(Work, w);
+  }
+
+  Work(0);
+
+  for (auto &w : workers) {
+    w.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// Calls func(index) for every item on all hardware threads, then
+// finish(index) under lock, in item order. Use for writing into shared,
+// order sensitive outputs.
+template <class Func, class Finish>
+void RunParallelOrdered(size_t numItems, Func &&func, Finish &&finish) {
+  std::mutex finishMutex;
+  std::condition_variable finishCondition;
+  size_t nextFinish = 0;
+  bool failed = false;
+
+  RunParallel(numItems, [&](size_t i) {
+    try {
+      func(i);
+
+      std::unique_lock lk(finishMutex);
+      finishCondition.wait(lk, [&] { return nextFinish == i || failed; });
+
+      if (failed) {
+        return;
+      }
+
+      finish(i);
+      nextFinish++;
+      finishCondition.notify_all();
+    } catch (...) {
+      {
+        std::lock_guard lg(finishMutex);
+        failed = true;
+      }
+      finishCondition.notify_all();
+      throw;
+    }
+  });
+}
+
+// Collects outputs of a single worker item, so they can be sent into shared
+// context at once
+struct BufferedExtractContext : AppExtractContext {
+  BufferedExtractContext(AppExtractContext *base_) : base(base_) {}
+
+  void NewFile(const std::string &path) override {
+    files.emplace_back(path, std::string{});
+  }
+
+  void SendData(std::string_view data) override {
+    files.back().second.append(data);
+  }
+
+  bool RequiresFolders() const override { return base->RequiresFolders(); }
+
+  void AddFolderPath(const std::string &path) override {
+    base->AddFolderPath(path);
+  }
+
+  void GenerateFolders() override { base->GenerateFolders(); }
+
+  void Flush(std::mutex &baseMutex) {
+    std::lock_guard lg(baseMutex);
+
+    for (auto &[path, data] : files) {
+      base->NewFile(path);
+      base->SendData(data);
+    }
+
+    files.clear();
+  }
+
+private:
+  AppExtractContext *base;
+  std::vector<std::pair<std::string, std::string>> files;
+};
@@ -0,0 +1,570 @@
+/*  InstallExtract
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "cinpack.hpp"
+#include "dtex.hpp"
+#include "dynpack.hpp"
+#include "francemap.hpp"
+#include "globalmap.hpp"
+#include "hashstorage.hpp"
+#include "installindex.hpp"
+#include "loosefiles.hpp"
+#include "megapack.hpp"
+#include "memstream.hpp"
+#include "meshgltf.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/stat.hpp"
+#include "spike/master_printer.hpp"
+#include "spike/reflect/reflector.hpp"
+#include "taskgraph.hpp"
+#include "tilepack.hpp"
+#include "workpool.hpp"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <sstream>
+
+// Need some anchor point, since loosefiles is stored all around
+std::string_view filters[]{
+    "*nimations.pack$",
+};
+
+struct InstallExtract : ReflectorBase<InstallExtract> {
+  bool convertTextures = true;
+  bool convertMeshes = true;
+  bool maskImages = false;
+} settings;
+
+REFLECT(CLASS(InstallExtract),
+        MEMBER(convertTextures, "t",
+               ReflDesc{"Convert textures into DDS in memory, instead of "
+                        "writing .dtex files."}),
+        MEMBER(convertMeshes, "g",
+               ReflDesc{"Convert meshes into GLB in memory, next to their "
+                        ".msh and .dat files."}),
+        MEMBER(maskImages, "m",
+               ReflDesc{"Convert tile masks into PNG images (or raw data with "
+                        "JSON sidecar, when mask size doesn't fit)."}));
+
+static AppInfo_s appInfo{
+    .filteredLoad = true,
+    .header = InstallExtract_DESC " v" InstallExtract_VERSION
+                                  ", " InstallExtract_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
+    .filters = filters,
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+bool AppInitContext(const std::string &dataFolder) {
+  hash::LoadStorage(dataFolder + "saboteur_strings.txt");
+  return true;
+}
+
+static std::string_view SubView(std::string_view data, size_t offset,
+                                size_t size) {
+  if (offset > data.size() || size > data.size() - offset) {
+    throw std::runtime_error("Entry out of archive bounds");
+  }
+
+  return data.substr(offset, size);
+}
+
+// Hands .dtex files over to onTexture instead of base. Meshes are written
+// into base and handed over to onMesh along with their .dat buffers.
+// Empty callback disables its conversion.
+struct ConvertExtractContext : AppExtractContext {
+  using TextureCallback =
+      std::function<void(std::string path, std::string data)>;
+  using MeshCallback = std::function<void(std::string path, std::string mesh,
+                                          std::string buffers)>;
+
+  ConvertExtractContext(AppExtractContext *base_, TextureCallback onTexture_,
+                        MeshCallback onMesh_)
+      : base(base_), onTexture(std::move(onTexture_)),
+        onMesh(std::move(onMesh_)) {}
+
+  void NewFile(const std::string &path) override {
+    FinishFile();
+
+    if (onTexture && path.ends_with(".dtex")) {
+      kind = Kind::Texture;
+    } else if (!meshPath.empty() && path.ends_with(".dat") &&
+               path.compare(0, path.size() - 4, meshPath, 0,
+                            meshPath.size() - 4) == 0) {
+      // ExtractMeshPack writes .dat stream right after .msh stream
+      kind = Kind::MeshBuffers;
+    } else {
+      FinishMesh();
+      kind = onMesh && path.ends_with(".msh") ? Kind::Mesh : Kind::Other;
+    }
+
+    if (kind != Kind::Texture) {
+      base->NewFile(path);
+    }
+
+    filePath = path;
+  }
+
+  void SendData(std::string_view data) override {
+    if (kind != Kind::Texture) {
+      base->SendData(data);
+    }
+
+    if (kind != Kind::Other) {
+      fileData.append(data);
+    }
+  }
+
+  bool RequiresFolders() const override { return base->RequiresFolders(); }
+
+  void AddFolderPath(const std::string &path) override {
+    base->AddFolderPath(path);
+  }
+
+  void GenerateFolders() override { base->GenerateFolders(); }
+
+  void Finish() {
+    FinishFile();
+    FinishMesh();
+  }
+
+private:
+  enum class Kind { Other, Texture, Mesh, MeshBuffers };
+
+  void FinishFile() {
+    switch (kind) {
+    case Kind::Texture:
+      onTexture(std::move(filePath), std::move(fileData));
+      break;
+    case Kind::Mesh:
+      meshPath = std::move(filePath);
+      meshData = std::move(fileData);
+      break;
+    case Kind::MeshBuffers:
+      onMesh(std::move(meshPath), std::move(meshData), std::move(fileData));
+      meshPath.clear();
+      break;
+    default:
+      break;
+    }
+
+    kind = Kind::Other;
+    filePath.clear();
+    fileData.clear();
+  }
+
+  // Mesh without .dat stream
+  void FinishMesh() {
+    if (!meshPath.empty()) {
+      onMesh(std::move(meshPath), std::move(meshData), {});
+      meshPath.clear();
+    }
+  }
+
+  AppExtractContext *base;
+  TextureCallback onTexture;
+  MeshCallback onMesh;
+  Kind kind = Kind::Other;
+  std::string filePath;
+  std::string fileData;
+  std::string meshPath;
+  std::string meshData;
+};
+
+void AppProcessFile(AppContext *ctx) {
+  const std::string workFolder(ctx->workingFile.GetFolder());
+  const InstallIndex install(workFolder);
+  AppExtractContext *ectx = ctx->ExtractContext("install");
+  std::mutex ectxMutex;
+
+  TaskGraph graph;
+  const size_t tableStage = graph.AddStage("tables");
+  const size_t nameStage = graph.AddStage("names");
+  const size_t megapackStage = graph.AddStage("megapack");
+  const size_t tilepackStage = graph.AddStage("tilepack");
+  const size_t globalStage = graph.AddStage("global");
+  const size_t franceStage = graph.AddStage("france");
+  const size_t textureStage = graph.AddStage("dtex_to_dds");
+  const size_t meshStage = graph.AddStage("mesh_to_gltf");
+  const size_t looseStage = graph.AddStage("loosefiles");
+  const size_t cinematicStage = graph.AddStage("cinematics");
+
+  // Archives stay mapped until graph is done, tasks get views into them
+  std::deque<es::MappedFile> archives;
+  std::mutex archivesMutex;
+
+  auto Map = [&](const std::filesystem::path &path) {
+    std::lock_guard lg(archivesMutex);
+    es::MappedFile &mapped = archives.emplace_back(path.string());
+    return std::string_view(static_cast<const char *>(mapped.data),
+                            mapped.fileSize);
+  };
+
+  auto Write = [&](const std::string &path, std::string_view data) {
+    std::lock_guard lg(ectxMutex);
+    ectx->NewFile(path);
+    ectx->SendData(data);
+  };
+
+  // dtex_to_dds stage, textures are handed over in memory
+  auto ConvertTexture = [&](std::string path, std::string data) {
+    graph.Add(textureStage, [&, path = std::move(path),
+                             data = std::move(data)] {
+      MemoryStream texStream(data);
+      std::string name;
+
+      try {
+        const std::string dds = DTEXToDDS(texStream, name);
+        Write(path.substr(0, path.find_last_of('/') + 1) + name + ".dds",
+              dds);
+      } catch (const std::exception &e) {
+        PrintWarning("Cannot convert ", path, ": ", e.what());
+        Write(path, data);
+      }
+    });
+  };
+
+  // mesh_to_gltf stage, .msh and .dat files are already written
+  auto ConvertMesh = [&](std::string path, std::string mesh,
+                         std::string buffers) {
+    graph.Add(meshStage, [&, path = std::move(path), mesh = std::move(mesh),
+                          buffers = std::move(buffers)] {
+      MemoryStream meshStream(mesh);
+      MemoryStream bufferStream(buffers);
+      std::stringstream glb;
+
+      try {
+        MeshToGLTF(meshStream, bufferStream, glb,
+                   workFolder + "install/" +
+                       path.substr(0, path.find_last_of('/') + 1));
+      } catch (const std::exception &e) {
+        PrintWarning("Cannot convert ", path, ": ", e.what());
+        return;
+      }
+
+      Write(path.substr(0, path.size() - 4) + ".glb", glb.str());
+    });
+  };
+
+  // Outputs of a task are buffered and written at once
+  auto ExtractBuffered = [&](auto &&extract) {
+    BufferedExtractContext bctx(ectx);
+    ConvertExtractContext cctx(&bctx,
+                               settings.convertTextures
+                                   ? ConvertExtractContext::TextureCallback(
+                                         ConvertTexture)
+                                   : nullptr,
+                               settings.convertMeshes
+                                   ? ConvertExtractContext::MeshCallback(
+                                         ConvertMesh)
+                                   : nullptr);
+    extract(&cctx);
+    cctx.Finish();
+    bctx.Flush(ectxMutex);
+  };
+
+  struct Megapack {
+    std::string name;
+    std::string_view data;
+    std::map<uint32, FileRange> files;
+  };
+
+  // mega0 holds dynamic packs of france.map, dynamic0 and palettes0 hold
+  // dynamic packs of global.map
+  std::deque<Megapack> megapacks;
+  std::vector<TaskGraph::TaskId> tableTasks;
+
+  for (auto name : {"mega0", "mega1", "mega2", "dynamic0", "palettes0"}) {
+    const std::string fileName = std::string(name) + ".megapack";
+    const std::filesystem::path *path = install.Find(fileName);
+
+    if (!path) {
+      PrintWarning("Couldn't find: ", fileName);
+      continue;
+    }
+
+    Megapack &m = megapacks.emplace_back();
+    m.name = name;
+    m.data = Map(*path);
+
+    tableTasks.emplace_back(graph.Add(tableStage, [&m] {
+      MemoryStream packStream(m.data);
+      m.files = LoadMegaPack(packStream);
+    }));
+  }
+
+  std::optional<LooseFilesIndex> looseIndex;
+  std::string_view looseData;
+
+  if (auto path = install.Find("loosefiles_", ".pack")) {
+    looseData = Map(*path);
+    tableTasks.emplace_back(graph.Add(tableStage, [&] {
+      looseIndex.emplace(looseData);
+
+      for (auto &f : looseIndex->files) {
+        graph.Add(looseStage, [&, file = &f] {
+          Write("loosefiles/" + file->name,
+                SubView(looseData, file->offset, file->size));
+        });
+      }
+    }));
+  }
+
+  // Maps and cinpack are read from loosefiles package, or from loose files
+  std::vector<GlobalPackDesc> globalMap;
+  std::optional<FranceMapItems> franceMap;
+  std::map<uint32, Cinematic> cinematics;
+
+  auto LoadMaps = [&] {
+    std::string_view cinData;
+
+    if (looseIndex) {
+      if (auto found = looseIndex->FindSuffix("inematics.cinpack")) {
+        cinData = SubView(looseData, found->offset, found->size);
+      }
+
+      if (auto found = looseIndex->FindSuffix("lobal.map")) {
+        MemoryStream mapStream(SubView(looseData, found->offset, found->size));
+        globalMap = LoadGlobalMap(mapStream);
+      }
+
+      if (auto found = looseIndex->FindSuffix("rance.map")) {
+        MemoryStream mapStream(SubView(looseData, found->offset, found->size));
+        franceMap = LoadFranceMap(mapStream);
+      }
+    }
+
+    if (cinData.empty()) {
+      if (auto path = install.Find("cinematics.cinpack")) {
+        cinData = Map(*path);
+      } else {
+        PrintWarning("Couldn't find cinematics.cinpack");
+      }
+    }
+
+    if (globalMap.empty()) {
+      try {
+        globalMap = FindGlobalMap(install);
+      } catch (const es::FileNotFoundError &) {
+        PrintWarning("global.map not found, skipping global dynamic packs");
+      }
+    }
+
+    if (!franceMap) {
+      try {
+        franceMap = FindFranceMap(install);
+      } catch (const es::FileNotFoundError &) {
+        PrintWarning("france.map not found, skipping france dynamic packs, "
+                     "cinematics are named by hashes");
+      }
+    }
+
+    if (cinData.empty()) {
+      return;
+    }
+
+    MemoryStream cinStream(cinData);
+    cinematics = LoadCinpack(cinStream, cinData.size());
+    std::map<uint32, std::string> names;
+
+    if (franceMap) {
+      for (auto &d : franceMap->packs) {
+        names.emplace(d.hash, d.name);
+      }
+    }
+
+    for (auto &[id, cin] : cinematics) {
+      const std::string_view data = SubView(cinData, cin.offset, cin.size);
+      auto found = names.find(id);
+      std::string name = es::IsEnd(names, found)
+                             ? std::to_string(hash::GetStringHash(id))
+                             : found->second;
+
+      graph.Add(cinematicStage, [&, data, name = std::move(name)] {
+        Write("cinematics/" + name + ".cin", data);
+      });
+    }
+  };
+
+  tableTasks.emplace_back(graph.Add(tableStage, LoadMaps, tableTasks));
+
+  // Dynamic packs are looked up in megapacks first, then as loose .pack files
+  auto FindPack = [&](uint32 hash, const std::string &looseName,
+                      std::initializer_list<std::string_view> packNames) {
+    for (auto &m : megapacks) {
+      if (std::find(packNames.begin(), packNames.end(), m.name) ==
+          packNames.end()) {
+        continue;
+      }
+
+      if (auto found = m.files.find(hash); !es::IsEnd(m.files, found)) {
+        return SubView(m.data, found->second.offset, found->second.size);
+      }
+    }
+
+    if (auto path = install.Find(looseName)) {
+      return Map(*path);
+    }
+
+    return std::string_view{};
+  };
+
+  struct DynamicPack {
+    std::string_view data;
+    std::string folder;
+    std::function<DynamicPackTables(BinReaderRef_e)> readTables;
+    size_t stage;
+  };
+
+  std::vector<DynamicPack> dynamicPacks;
+
+  // Every pack is walked twice, once to register mesh names and once to
+  // extract it, so names of other assets don't depend on task order
+  auto ExtractDynamic = [&](const DynamicPack &p, bool namesOnly) {
+    MemoryStream packStream(p.data);
+    const DynamicPackTables tables = p.readTables(packStream);
+    std::string inBuffer;
+    std::string outBuffer;
+
+    if (namesOnly) {
+      ExtractDynamicPack(packStream, tables, p.folder, nullptr, inBuffer,
+                         outBuffer, {}, true);
+      return;
+    }
+
+    ExtractBuffered([&](AppExtractContext *pctx) {
+      ExtractDynamicPack(packStream, tables, p.folder, pctx, inBuffer,
+                         outBuffer);
+    });
+  };
+
+  // tilepack stage, extracted from mapped megapack
+  auto ExtractTiles = [&](std::string_view data, std::string curPath) {
+    graph.Add(tilepackStage, [&, data, curPath = std::move(curPath)] {
+      ExtractBuffered([&](AppExtractContext *tctx) {
+        MemoryStream tileStream(data);
+        // Masks are converted by this task, graph already uses every worker
+        ExtractTilePack(tileStream, curPath, tctx, settings.maskImages, {},
+                        false);
+      });
+    });
+  };
+
+  // megapack stage, entries are views into mapped megapack
+  auto ExtractMegapacks = [&] {
+    for (auto &m : megapacks) {
+      if (!m.name.starts_with("mega")) {
+        continue;
+      }
+
+      for (auto &[id, range] : m.files) {
+        const std::string_view data = SubView(m.data, range.offset, range.size);
+        const std::string fileName =
+            m.name + '/' + std::to_string(hash::GetStringHash(id));
+
+        graph.Add(megapackStage, [&, data, fileName] {
+          uint32 fourCC = 0;
+          memcpy(&fourCC, data.data(), std::min<size_t>(data.size(), 4));
+
+          if (IsTilePack(data)) {
+            ExtractTiles(data, fileName + '/');
+          } else if (fourCC != SBLA_ID && fourCC != SBLA_ID_BE) {
+            // Dynamic packs are unpacked by global and france stages
+            Write(fileName + ".dat", data);
+          }
+        });
+      }
+    }
+
+    for (auto &p : dynamicPacks) {
+      graph.Add(p.stage, [&, pack = &p] { ExtractDynamic(*pack, false); });
+    }
+  };
+
+  // Registers names of all meshes and masks before anything is extracted
+  auto RegisterNames = [&] {
+    std::vector<TaskGraph::TaskId> nameTasks;
+
+    for (auto &d : globalMap) {
+      const std::string_view data =
+          FindPack(d.assetIndex, d.name + ".pack", {"dynamic0", "palettes0"});
+
+      if (data.empty()) {
+        PrintWarning("Couldn't find: [",
+                     std::to_string(hash::GetStringHash(d.assetIndex)), "] ",
+                     d.name);
+        continue;
+      }
+
+      dynamicPacks.emplace_back(DynamicPack{
+          data, "global/" + d.name + '/',
+          [&d](BinReaderRef_e rd) { return ReadDynamicPackTables(rd, d); },
+          globalStage});
+    }
+
+    if (franceMap) {
+      for (auto &d : franceMap->packs) {
+        const std::string_view data =
+            FindPack(d.hash, std::to_string(d.hash) + ".pack",
+                     {"mega0", "mega1", "mega2"});
+
+        if (data.empty()) {
+          if (!cinematics.contains(d.hash)) {
+            PrintWarning("Couldn't find: ",
+                         std::to_string(hash::GetStringHash(d.hash)));
+          }
+
+          continue;
+        }
+
+        dynamicPacks.emplace_back(DynamicPack{
+            data, "france/" + d.name + '/',
+            [&d](BinReaderRef_e rd) { return ReadDynamicPackTables(rd, d); },
+            franceStage});
+      }
+    }
+
+    for (auto &p : dynamicPacks) {
+      nameTasks.emplace_back(graph.Add(
+          nameStage, [&, pack = &p] { ExtractDynamic(*pack, true); }));
+    }
+
+    for (auto &m : megapacks) {
+      for (auto &[id, range] : m.files) {
+        const std::string_view data = SubView(m.data, range.offset, range.size);
+
+        if (IsTilePack(data)) {
+          nameTasks.emplace_back(graph.Add(nameStage, [data] {
+            MemoryStream tileStream(data);
+            RegisterTilePackNames(IndexTilePack(tileStream));
+          }));
+        }
+      }
+    }
+
+    graph.Add(nameStage, ExtractMegapacks, nameTasks);
+  };
+
+  graph.Add(nameStage, RegisterNames, tableTasks);
+  graph.Run();
+}
@@ -15,20 +15,38 @@
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "loosefiles.hpp"
+#include "mappedarchive.hpp"
 #include "project.h"
 #include "spike/app_context.hpp"
 #include "spike/io/binreader_stream.hpp"
 #include "spike/master_printer.hpp"
 #include "spike/reflect/reflector.hpp"
+#include "workpool.hpp"
 
 std::string_view filters[]{
     "loosefiles_*.pack$",
 };
 
+struct LooseFiles : ReflectorBase<LooseFiles> {
+  bool indexCache = false;
+  bool parallel = false;
+} settings;
+
+REFLECT(CLASS(LooseFiles),
+        MEMBER(indexCache, "c",
+               ReflDesc{"Save archive index next to it as .idx and reuse it "
+                        "while the archive is unchanged."}),
+        MEMBER(parallel, "P",
+               ReflDesc{"Read ahead: page in entries of mapped archive on "
+                        "all hardware threads. Writing is still sequential, "
+                        "in archive order."}));
+
 static AppInfo_s appInfo{
     .filteredLoad = true,
     .header = LooseFiles_DESC " v" LooseFiles_VERSION ", " LooseFiles_COPYRIGHT
                               "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
     .filters = filters,
 };
 
@@ -37,20 +55,33 @@ AppInfo_s *AppInitModule() { return &appInfo; }
 void AppProcessFile(AppContext *ctx) {
   BinReaderRef rd(ctx->GetStream());
   auto ectx = ctx->ExtractContext();
-  std::string bufferStr;
-
-  const size_t filesSize = rd.GetSize();
-
-  while (rd.Tell() < filesSize) {
-    uint32 hash;
-    rd.Read(hash);
-    uint32 dataSize;
-    rd.Read(dataSize);
-    char name[120];
-    rd.Read(name);
-    ectx->NewFile(name);
-    rd.ReadContainer(bufferStr, dataSize);
-    rd.ApplyPadding(16);
-    ectx->SendData(bufferStr);
+  MappedArchive archive(ctx);
+
+  LooseFilesIndex index = LoadLooseFilesIndex(
+      rd, std::string(ctx->workingFile.GetFullPath()), settings.indexCache,
+      archive.View());
+
+  if (!settings.parallel || !archive.Mapped()) {
+    for (auto &f : index.files) {
+      ectx->NewFile(f.name);
+      ectx->SendData(archive.Get(f.offset, f.size));
+    }
+
+    return;
   }
+
+  // Extract context is not thread safe, workers only page in their entries
+  // and then send them in archive order. This only hides archive reads,
+  // writing stays serialized.
+  RunParallelOrdered(
+      index.files.size(),
+      [&](size_t i) {
+        const LooseFile &f = index.files[i];
+        MappedArchive::Prefault(archive.View().substr(f.offset, f.size));
+      },
+      [&](size_t i) {
+        const LooseFile &f = index.files[i];
+        ectx->NewFile(f.name);
+        ectx->SendData(archive.View().substr(f.offset, f.size));
+      });
 }
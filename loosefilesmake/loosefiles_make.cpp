@@ -0,0 +1,125 @@
+/*  LooseFilesMake
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "hashstorage.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/binwritter_stream.hpp"
+#include "spike/master_printer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+static AppInfo_s appInfo{
+    .mode = AppMode_e::PACK,
+    .header = LooseFilesMake_DESC " v" LooseFilesMake_VERSION
+                                  ", " LooseFilesMake_COPYRIGHT "Lukas Cone",
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+// Entries are streamed into archive as they come, see loosefiles.hpp for
+// layout
+struct LooseFilesWriter : AppPackContext {
+  LooseFilesWriter(const std::string &outPath_)
+      : outPath(outPath_), outStream(outPath, std::ios::binary) {
+    if (outStream.fail()) {
+      throw es::FileInvalidAccessError(outPath);
+    }
+  }
+
+  void SendFile(std::string_view path, std::istream &stream) override;
+  void Finish() override;
+
+private:
+  std::string outPath;
+  std::ofstream outStream;
+  std::mutex outMutex;
+  std::string buffer;
+  size_t numFiles = 0;
+  size_t dataSize = 0;
+  std::chrono::steady_clock::time_point startTime =
+      std::chrono::steady_clock::now();
+};
+
+void LooseFilesWriter::SendFile(std::string_view path, std::istream &stream) {
+  std::string name(path);
+  std::replace(name.begin(), name.end(), '\\', '/');
+  char nameField[120]{};
+
+  if (name.size() > sizeof(nameField)) {
+    throw std::runtime_error("Name is longer than 120 characters: " + name);
+  }
+
+  memcpy(nameField, name.data(), name.size());
+
+  stream.seekg(0, std::ios::end);
+  const size_t fileSize = stream.tellg();
+  stream.seekg(0);
+
+  std::lock_guard lg(outMutex);
+  BinWritterRef wr(outStream);
+  wr.Write(hash::GetHash(name));
+  wr.Write(uint32(fileSize));
+  wr.Write(nameField);
+
+  static constexpr size_t CHUNK_SIZE = 0x100000;
+  buffer.resize(CHUNK_SIZE);
+
+  for (size_t left = fileSize; left > 0;) {
+    const size_t chunkSize = std::min(left, CHUNK_SIZE);
+    stream.read(buffer.data(), chunkSize);
+
+    if (size_t(stream.gcount()) != chunkSize) {
+      throw std::runtime_error("Failed to read: " + name);
+    }
+
+    wr.WriteBuffer(buffer.data(), chunkSize);
+    left -= chunkSize;
+  }
+
+  wr.ApplyPadding(16);
+  numFiles++;
+  dataSize += fileSize;
+}
+
+void LooseFilesWriter::Finish() {
+  outStream.close();
+
+  if (outStream.fail()) {
+    throw es::FileInvalidAccessError(outPath);
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  PrintInfo("Written ", numFiles, " files (", dataSize, " bytes) into ",
+            outPath, " in ", elapsed.count(), "s");
+}
+
+AppPackContext *AppNewArchive(const std::string &folder, const AppPackStats &) {
+  std::string outPath = folder;
+
+  while (outPath.ends_with('/') || outPath.ends_with('\\')) {
+    outPath.pop_back();
+  }
+
+  // Keep original pack, that is usually next to its extracted folder
+  return new LooseFilesWriter(outPath + "_new.pack");
+}
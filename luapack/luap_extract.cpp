@@ -15,13 +15,13 @@
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "luapack.hpp"
+#include "mappedarchive.hpp"
 #include "project.h"
 #include "spike/app_context.hpp"
-#include "spike/except.hpp"
 #include "spike/io/binreader_stream.hpp"
 #include "spike/master_printer.hpp"
 #include "spike/reflect/reflector.hpp"
-#include <cassert>
 
 std::string_view filters[]{
     "*.luap$",
@@ -36,82 +36,18 @@ static AppInfo_s appInfo{
 
 AppInfo_s *AppInitModule() { return &appInfo; }
 
-struct File {
-  uint32 id0;
-  uint32 id1;
-  uint32 offset;
-  uint32 compressedSize;
-  uint32 uncompressedSize;
-};
-
-struct File_ : File {
-  void Read(BinReaderRef rd) {
-    rd.Read<File>(*this);
-    uint8 null;
-    rd.Read(null);
-    assert(null < 2);
-  }
-};
-
-static constexpr uint32 LUA_ID = CompileFourCC("\x1BLua");
-
-struct Lua {
-  uint32 id;
-  uint8 version;
-  uint8 format;
-  uint8 endian;
-  uint8 intSize;
-  uint8 size_tSize;
-  uint8 instructionSize;
-  uint8 numberSize;
-  uint8 internalFlag;
-};
-
 void AppProcessFile(AppContext *ctx) {
   BinReaderRef rd(ctx->GetStream());
-  rd.Push();
-  uint32 numFiles;
-  rd.Read(numFiles);
-  rd.Pop();
-
-  if (numFiles > 0x1000) {
-    FByteswapper(numFiles);
-
-    if (numFiles > 0x1000) {
-      throw es::InvalidHeaderError(numFiles);
-    }
-    rd.SwapEndian(true);
-  }
 
   // TODO folder gen
 
-  std::vector<File_> files;
-  rd.ReadContainer(files);
+  std::vector<LuaFile_> files = LoadLuaPack(rd);
 
   auto ectx = ctx->ExtractContext();
-  std::string bufferStr;
+  MappedArchive archive(ctx);
 
   for (auto &f : files) {
-    rd.Seek(f.offset);
-    assert(f.compressedSize == f.uncompressedSize);
-    rd.Push();
-    Lua hdr;
-    rd.Read(hdr);
-
-    assert(hdr.id == LUA_ID);
-
-    std::string sourceName;
-    rd.ReadContainer(sourceName);
-    rd.Pop();
-
-    AFileInfo sourcePath(sourceName);
-    auto foundRoot = sourcePath.GetFullPath().find("cripts/");
-
-    if (foundRoot != std::string::npos) {
-      sourceName = sourcePath.GetFullPath().substr(foundRoot - 1);
-    }
-    ectx->NewFile(sourceName);
-    rd.ReadContainer(bufferStr, f.compressedSize);
-    ectx->SendData(bufferStr);
+    ectx->NewFile(LuaSourceName(rd, f));
+    ectx->SendData(archive.Get(f.offset, f.compressedSize));
   }
 }
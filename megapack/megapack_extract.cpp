@@ -15,12 +15,18 @@
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "dedup.hpp"
+#include "mappedarchive.hpp"
 #include "megapack.hpp"
 #include "project.h"
 #include "spike/app_context.hpp"
 #include "spike/except.hpp"
 #include "spike/io/binreader_stream.hpp"
+#include "spike/master_printer.hpp"
 #include "spike/reflect/reflector.hpp"
+#include "tilepack.hpp"
+#include <chrono>
+#include <optional>
 
 std::string_view filters[]{
     ".kilopack$",
@@ -29,10 +35,36 @@ std::string_view filters[]{
     ".megaPack$",
 };
 
+struct MegaPack : ReflectorBase<MegaPack> {
+  bool deduplicate = false;
+  bool extractTiles = false;
+  bool parallel = false;
+  bool maskImages = false;
+  bool dryRun = false;
+} settings;
+
+REFLECT(CLASS(MegaPack),
+        MEMBER(deduplicate, "D",
+               ReflDesc{"Write repeated megapack entries and tile files only "
+                        "once, dedup_manifest.txt maps copies to them."}),
+        MEMBER(extractTiles, "T",
+               ReflDesc{"Extract map tile packs directly, same as running "
+                        "tilepack_extract on extracted .pack files."}),
+        MEMBER(parallel, "P",
+               ReflDesc{"Decompress entries of map tile packs on all cores. "
+                        "Requires extractTiles."}),
+        MEMBER(maskImages, "m",
+               ReflDesc{"Convert tile masks into PNG images (or raw data with "
+                        "JSON sidecar). Requires extractTiles."}),
+        MEMBER(dryRun, "n",
+               ReflDesc{"Don't extract anything, only report file counts and "
+                        "sizes per folder from tables."}));
+
 static AppInfo_s appInfo{
     .filteredLoad = true,
     .header = MegaPack_DESC " v" MegaPack_VERSION ", " MegaPack_COPYRIGHT
                             "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
     .filters = filters,
 };
 
@@ -61,25 +93,84 @@ void AppProcessFile(AppContext *ctx) {
   // std::vector<FileId> fileIds;
   // rd.ReadContainer(fileIds, files.size());
 
-  auto ectx = ctx->ExtractContext();
-  std::string bufferStr;
+  if (settings.dryRun) {
+    ExtractPlan plan;
+
+    for (auto &f : files) {
+      // Only tile packs are unpacked, their type is in first 8 bytes
+      if (settings.extractTiles) {
+        std::string header;
+        rd.Seek(f.offset);
+        rd.Push();
+        rd.ReadContainer(header, std::min<uint32>(f.size, 8));
+        rd.Pop();
+
+        if (IsTilePack(header)) {
+          PlanTilePack(rd, std::to_string(hash::GetStringHash(f.id.index)),
+                       plan);
+          continue;
+        }
+      }
+
+      plan.Add({}, f.size, f.size);
+    }
 
-  for (auto &f : files) {
-    rd.Seek(f.offset);
-    rd.ReadContainer(bufferStr, f.size);
+    plan.Print();
+    return;
+  }
+
+  AppExtractContext *ectx = ctx->ExtractContext();
+  std::optional<DedupExtractContext> dedup;
+
+  if (settings.deduplicate) {
+    ectx = &dedup.emplace(ectx);
+  }
 
-    static constexpr uint32 SBLA_ID = CompileFourCC("ALBS");
-    static constexpr uint32 SBLA_ID_BE = CompileFourCC("SBLA");
+  MappedArchive archive(ctx);
+  size_t numTiles = 0;
+  size_t tileBytes = 0;
+  auto startTime = std::chrono::steady_clock::now();
 
-    uint32 id;
-    memcpy(&id, bufferStr.data(), 4);
+  for (auto &f : files) {
+    std::string_view data = archive.Get(f.offset, f.size);
+
+    uint32 id = 0;
+    memcpy(&id, data.data(), std::min<size_t>(data.size(), 4));
     const char *ext = ".dat";
+    const std::string name = std::to_string(hash::GetStringHash(f.id.index));
 
     if (id == SBLA_ID || id == SBLA_ID_BE) {
       ext = ".pack";
+
+      // Dynamic packs are written as .pack, they are unpacked by
+      // global_extract and france_extract
+      if (settings.extractTiles && IsTilePack(data)) {
+        if (settings.parallel) {
+          ExtractTilePackParallel(data, name + '/', ectx, settings.maskImages);
+        } else {
+          MemoryStream tileStream(data);
+          ExtractTilePack(tileStream, name + '/', ectx, settings.maskImages);
+        }
+
+        numTiles++;
+        tileBytes += data.size();
+        continue;
+      }
     }
 
-    ectx->NewFile(std::to_string(hash::GetStringHash(f.id.index)) + ext);
-    ectx->SendData(bufferStr);
+    ectx->NewFile(name + ext);
+    ectx->SendData(data);
+  }
+
+  if (dedup) {
+    dedup->Finish();
+  }
+
+  if (numTiles) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - startTime;
+    PrintInfo("Extracted ", numTiles, " tile packs in memory, ", tileBytes,
+              " bytes of intermediate .pack files not written, total time ",
+              elapsed.count(), "s");
   }
 }
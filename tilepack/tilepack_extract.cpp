@@ -15,19 +15,62 @@
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "dedup.hpp"
+#include "extractmanifest.hpp"
 #include "hashstorage.hpp"
-#include "meshpack.hpp"
+#include "mappedarchive.hpp"
 #include "project.h"
 #include "spike/app_context.hpp"
 #include "spike/except.hpp"
 #include "spike/io/binreader_stream.hpp"
 #include "spike/reflect/reflector.hpp"
-#include <cassert>
+#include "tilepack.hpp"
+#include <filesystem>
+#include <mutex>
+#include <optional>
+
+struct TilePack : ReflectorBase<TilePack> {
+  bool deduplicate = false;
+  bool parallel = false;
+  bool maskImages = false;
+  bool rebuildInfo = false;
+  bool incremental = false;
+  bool dryRun = false;
+  std::string includeTypes;
+  std::string excludeTypes;
+} settings;
+
+REFLECT(CLASS(TilePack),
+        MEMBER(deduplicate, "D",
+               ReflDesc{"Write files repeated in input tile packs only once, "
+                        "dedup_manifest.txt maps copies to them."}),
+        MEMBER(parallel, "P",
+               ReflDesc{"Load whole pack into memory and decompress entries "
+                        "on all cores."}),
+        MEMBER(maskImages, "m",
+               ReflDesc{"Convert masks into PNG images (or raw data with JSON "
+                        "sidecar), without writing .mask files."}),
+        MEMBER(rebuildInfo, "R",
+               ReflDesc{"Write sbla.meta with tables and compression info, "
+                        "required by tilepack_make."}),
+        MEMBER(incremental, "I",
+               ReflDesc{"Skip entries unchanged since last run, whose outputs "
+                        "still exist. Uses extract_manifest.txt."}),
+        MEMBER(dryRun, "n",
+               ReflDesc{"Don't extract anything, only report file counts and "
+                        "sizes from tables."}),
+        MEMBER(includeTypes, "i",
+               ReflDesc{"Extract only listed asset types: mesh, layout, "
+                        "phys, fb, pv, mask (heightmap packs), texture (meta "
+                        "packs). Empty for all."}),
+        MEMBER(excludeTypes, "e",
+               ReflDesc{"Skip listed asset types, same names as above."}));
 
 static AppInfo_s appInfo{
     .filteredLoad = true,
     .header = TilePack_DESC " v" TilePack_VERSION ", " TilePack_COPYRIGHT
                             "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
 };
 
 AppInfo_s *AppInitModule() { return &appInfo; }
@@ -37,276 +80,126 @@ bool AppInitContext(const std::string &dataFolder) {
   return true;
 }
 
-static constexpr uint32 SBLA_ID = CompileFourCC("ALBS");
-static constexpr uint32 SBLA_ID_BE = CompileFourCC("SBLA");
-static constexpr uint32 HEI1_ID = CompileFourCC("1IEH");
-
-struct HeiFile {
-  uint32 hash0;
-  uint32 offset;
-  uint32 size;
-  uint32 uncompressedSize;
-  uint32 null;
-  uint32 hash1;
-};
-
-template <> void FByteswapper(HeiFile &id, bool) {
-  FByteswapper(id.hash0);
-  FByteswapper(id.offset);
-  FByteswapper(id.size);
-  FByteswapper(id.uncompressedSize);
-  FByteswapper(id.hash1);
-}
-
-struct HeightHeader {
-  uint32 id;
-  uint32 numWBlocks;
-  uint32 numHBlocks;
-  float width;
-  float height;
-};
-
-template <> void FByteswapper(HeightHeader &id, bool) {
-  FByteswapper(id.id);
-  FByteswapper(id.numWBlocks);
-  FByteswapper(id.numHBlocks);
-  FByteswapper(id.width);
-  FByteswapper(id.height);
-}
-
-struct HeightMeta {
-  uint32 null0[3];
-  uint32 numMeshes;
-  uint32 numMasks;
-  uint32 numPhys;
-  uint32 numFB;
-  uint32 numPV;
-  uint32 unk2[3];
-  uint32 numLayouts;
-  uint32 null1;
-};
-
-template <> void FByteswapper(HeightMeta &id, bool) {
-  FByteswapper(id.null0[3]);
-  FByteswapper(id.numMeshes);
-  FByteswapper(id.numMasks);
-  FByteswapper(id.numPhys);
-  FByteswapper(id.numFB);
-  FByteswapper(id.numPV);
-  FByteswapper(id.unk2[3]);
-  FByteswapper(id.numLayouts);
-  FByteswapper(id.null1);
-}
-
-struct HeightBlock {
-  uint32 hash;
-  std::vector<uint32> hashes;
-
-  void Read(BinReaderRef_e rd) {
-    rd.Read(hash);
-    rd.ReadContainer(hashes);
-  }
-};
-
-struct Height {
-  HeightHeader hdr;
-  std::vector<uint8> data;
-  HeightMeta meta;
-  std::vector<uint32> hashes;
-  std::vector<HeightBlock> blocks;
-
-  void Read(BinReaderRef_e rd) {
-    rd.Read(hdr);
-    if (hdr.id != HEI1_ID) {
-      throw es::InvalidHeaderError(hdr.id);
-    }
-    rd.ReadContainer(data, hdr.numHBlocks * hdr.numWBlocks);
-    rd.Read(meta);
-    rd.ReadContainer(hashes);
-    rd.ReadContainer(blocks);
-
-    assert(meta.null0[0] == 0);
-    assert(meta.null0[1] == 0);
-    // assert(meta.null0[2] == 0);
-    assert(meta.unk2[0] == 0);
-    assert(meta.unk2[1] == 0);
-    assert(meta.unk2[2] == 0);
-    assert(meta.null1 == 0);
-  }
-};
-
-struct Mask {
-  std::string fileName;
-  uint32 unk0[2];
-  uint16 unk1[3];
-  uint32 uncompressedSize;
-  uint32 unk2;
-  uint32 size;
-
-  void Read(BinReaderRef_e rd) {
-    rd.ReadContainer(fileName);
-    rd.Read(unk0);
-    rd.Read(unk1);
-    rd.Read(uncompressedSize);
-    rd.Read(unk2);
-    rd.Read(size);
-  }
-};
-
-struct Meta {
-  uint32 null0[3];
-  uint32 numMeshes;
-  uint32 numTextures;
-  uint32 null1[6];
-  uint32 numLayouts;
-  uint32 null2[3];
-};
-
-template <> void FByteswapper(Meta &id, bool) {
-  FByteswapper(id.null0);
-  FByteswapper(id.numMeshes);
-  FByteswapper(id.numLayouts);
-  FByteswapper(id.null1);
-  FByteswapper(id.numTextures);
-  FByteswapper(id.null2);
-}
-
 void AppProcessFile(AppContext *ctx) {
-  BinReaderRef_e rd(ctx->GetStream());
-  uint32 id;
-  rd.Read(id);
-
-  if (id != SBLA_ID) {
-    if (id == SBLA_ID_BE) {
-      rd.SwapEndian(true);
-    } else {
-      throw es::InvalidHeaderError(id);
-    }
+  // Stored entries are sent straight from mapped pack
+  MappedArchive mapped(ctx);
+  std::optional<MemoryStream> mappedStream;
+  BinReaderRef_e rd(mapped.Mapped() ? mappedStream.emplace(mapped.View())
+                                     : ctx->GetStream());
+
+  if (settings.dryRun) {
+    ExtractPlan plan;
+    PlanTilePack(rd, {}, plan,
+                 AssetFilter(settings.includeTypes, settings.excludeTypes));
+    plan.Print();
+    return;
   }
 
-  int32 metaSize;
-  rd.Read(metaSize);
+  AppExtractContext *output = ctx->ExtractContext();
+  AppExtractContext *ectx = output;
+  std::optional<DedupExtractContext> dedup;
 
-  if (metaSize < 1) {
-    throw std::runtime_error("Expected metadata");
+  if (settings.deduplicate) {
+    ectx = &dedup.emplace(ectx);
   }
 
-  std::string inBuffer;
-  std::string outBuffer;
-
-  Height meta;
-  rd.Push();
-  try {
-    rd.Read(meta);
-  } catch (const es::InvalidHeaderError &e) {
-    if (metaSize != 0x3c) {
-      throw std::runtime_error("Unknown pack type.");
-    }
-    rd.Pop();
-
-    Meta meta;
-    rd.Read(meta);
-
-    std::vector<HeiFile> meshes;
-    std::vector<HeiFile> layouts;
-    std::vector<HeiFile> textures;
-
-    rd.ReadContainer(meshes, meta.numMeshes);
-    rd.ReadContainer(layouts, meta.numLayouts);
-    rd.ReadContainer(textures, meta.numTextures);
-
-    assert(meta.null0[0] == 0);
-    assert(meta.null0[1] == 0);
-    assert(meta.null0[2] == 0);
-    assert(meta.null1[0] == 0);
-    assert(meta.null1[1] == 0);
-    assert(meta.null1[2] == 0);
-    assert(meta.null1[3] == 0);
-    assert(meta.null1[4] == 0);
-    assert(meta.null1[5] == 0);
-    assert(meta.null2[0] == 0);
-    assert(meta.null2[1] == 0);
-    assert(meta.null2[2] == 0);
-
-    auto ectx = ctx->ExtractContext();
-
-    for (auto &m : meshes) {
-      auto mName = ExtractMeshPack(rd, {}, ectx, inBuffer, outBuffer);
-      hash::GetStringHash(m.hash0, mName);
-    }
-
-    for (auto &s : layouts) {
-      ectx->NewFile(
-          std::to_string(hash::GetStringHash(s.hash1 ? s.hash1 : s.hash0)) +
-          ".lay");
-      Extract(ectx, s.size, s.uncompressedSize, inBuffer, outBuffer, rd);
-    }
-
-    const char *dtex = rd.SwappedEndian() ? "XETD" : "DTEX";
-
-    for (auto &df : textures) {
-      if (!df.size) {
+  const AssetFilter filter(settings.includeTypes, settings.excludeTypes);
+
+  if (settings.incremental) {
+    // Default output folder is pack path without extension
+    std::filesystem::path outFolder(ctx->workingFile.GetFullPath());
+    ExtractManifest manifest(output, outFolder.replace_extension().string(),
+                             std::string(TilePack_VERSION) + ' ' +
+                                 settings.includeTypes + ':' +
+                                 settings.excludeTypes +
+                                 (settings.maskImages ? " m" : "") +
+                                 (dedup ? " d" : ""),
+                             dedup ? &*dedup : nullptr);
+    const TilePackIndex index = IndexTilePack(rd);
+    BinReaderRef_e packRd(rd);
+    packRd.SwapEndian(index.swappedEndian);
+    const std::string archive(ctx->workingFile.GetFilenameExt());
+    std::vector<std::pair<const TileEntry *, ManifestSource>> changed;
+    std::string buffer;
+
+    for (auto &e : index.entries) {
+      if (!filter.Accepts(TileAssetType(e.type))) {
         continue;
       }
 
-      rd.ReadContainer(inBuffer, df.size);
+      packRd.Seek(e.offset);
+      ManifestSource source =
+          MakeManifestSource(packRd, archive, e.size, buffer);
 
-      ectx->NewFile(std::to_string(hash::GetStringHash(df.hash0)) + ".dtex");
-      ectx->SendData(dtex);
-      ectx->SendData(inBuffer);
+      if (manifest.Unchanged(source)) {
+        if (!e.name.empty()) {
+          hash::GetStringHash(e.hash, e.name);
+        }
+      } else {
+        changed.emplace_back(&e, std::move(source));
+      }
     }
 
-    return;
-  }
-
-  auto ectx = ctx->ExtractContext();
-
-  std::vector<HeiFile> meshes;
-  std::vector<HeiFile> phys;
-  std::vector<HeiFile> layouts;
-  std::vector<HeiFile> fbData;
-  std::vector<HeiFile> pvData;
-  std::vector<HeiFile> masks;
+    auto ExtractChanged = [&](BinReaderRef_e entryRd, AppExtractContext *base,
+                              size_t i) {
+      auto &[entry, source] = changed[i];
+      ManifestExtractContext mctx(base);
+      std::string inBuffer;
+      std::string outBuffer;
+      ExtractTileEntry(entryRd, *entry, {}, &mctx, inBuffer, outBuffer,
+                       settings.maskImages);
+      manifest.Add(source, std::move(mctx.outputs));
+    };
+
+    if (settings.parallel) {
+      std::string packData;
+      std::string_view packView = mapped.View();
+
+      if (!mapped.Mapped()) {
+        packRd.Seek(0);
+        packRd.ReadContainer(packData, packRd.GetSize());
+        packView = packData;
+      }
 
-  rd.ReadContainer(meshes, meta.meta.numMeshes);
-  rd.ReadContainer(phys, meta.meta.numPhys);
-  rd.ReadContainer(layouts, meta.meta.numLayouts);
-  rd.ReadContainer(fbData, meta.meta.numFB);
-  rd.ReadContainer(pvData, meta.meta.numPV);
-  rd.ReadContainer(masks, meta.meta.numMasks);
+      std::mutex ectxMutex;
 
-  for (auto &m : meshes) {
-    auto mName = ExtractMeshPack(rd, {}, ectx, inBuffer, outBuffer);
-    hash::GetStringHash(m.hash0, mName);
-  }
+      RunParallel(changed.size(), [&](size_t i) {
+        MemoryStream entryStream(packView);
+        BinReaderRef_e entryRd(entryStream);
+        entryRd.SwapEndian(index.swappedEndian);
+        BufferedExtractContext bctx(ectx);
+        ExtractChanged(entryRd, &bctx, i);
+        bctx.Flush(ectxMutex);
+      });
+    } else {
+      for (size_t i = 0; i < changed.size(); i++) {
+        ExtractChanged(packRd, ectx, i);
+      }
+    }
 
-  for (auto &df : phys) {
-    ectx->NewFile(std::to_string(hash::GetStringHash(df.hash0)) + ".phy");
-    Extract(ectx, df.size, df.uncompressedSize, inBuffer, outBuffer, rd);
-  }
+    manifest.Save(ectx);
+  } else if (settings.parallel) {
+    std::string packData;
+    std::string_view packView = mapped.View();
 
-  for (auto &s : layouts) {
-    ectx->NewFile(
-        std::to_string(hash::GetStringHash(s.hash1 ? s.hash1 : s.hash0)) +
-        ".lay");
-    Extract(ectx, s.size, s.uncompressedSize, inBuffer, outBuffer, rd);
-  }
+    if (!mapped.Mapped()) {
+      rd.ReadContainer(packData, rd.GetSize());
+      packView = packData;
+    }
 
-  for (auto &s : fbData) {
-    ectx->NewFile(std::to_string(hash::GetStringHash(s.hash0)) + ".fb");
-    Extract(ectx, s.size, s.uncompressedSize, inBuffer, outBuffer, rd);
+    ExtractTilePackParallel(packView, {}, ectx, settings.maskImages, filter);
+  } else {
+    ExtractTilePack(rd, {}, ectx, settings.maskImages, filter);
   }
 
-  for (auto &s : pvData) {
-    ectx->NewFile(std::to_string(hash::GetStringHash(s.hash0)) + ".pv");
-    Extract(ectx, s.size, s.uncompressedSize, inBuffer, outBuffer, rd);
+  if (settings.rebuildInfo) {
+    rd.Seek(0);
+    const TilePackIndex index = IndexTilePack(rd);
+    ectx->NewFile("sbla.meta");
+    ectx->SendData(MakeTilePackMeta(rd, index, {}).Save());
   }
 
-  for (auto &s : masks) {
-    Mask mask;
-    rd.Read(mask);
-    ectx->NewFile(mask.fileName + ".mask");
-    Extract(ectx, mask.size, mask.uncompressedSize, inBuffer, outBuffer, rd);
-    hash::GetStringHash(s.hash0, mask.fileName);
+  if (dedup) {
+    dedup->Finish();
   }
 }
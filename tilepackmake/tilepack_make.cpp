@@ -0,0 +1,263 @@
+/*  TilePackMake
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/binwritter_stream.hpp"
+#include "spike/master_printer.hpp"
+#include "tilepack.hpp"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+static AppInfo_s appInfo{
+    .mode = AppMode_e::PACK,
+    .header = TilePackMake_DESC " v" TilePackMake_VERSION
+                                ", " TilePackMake_COPYRIGHT "Lukas Cone",
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+// Compressed chunk size is 16 bit, uncompressed chunk must not exceed it
+static constexpr uint32 SEGS_CHUNK_SIZE = 0x8000;
+
+static std::string Deflate(std::string_view data, int32 wbits) {
+  z_stream strm{};
+  deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, wbits, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string retVal(deflateBound(&strm, data.size()), 0);
+  strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  strm.avail_in = data.size();
+  strm.next_out = reinterpret_cast<Bytef *>(retVal.data());
+  strm.avail_out = retVal.size();
+  const int state = deflate(&strm, Z_FINISH);
+  deflateEnd(&strm);
+
+  if (state != Z_STREAM_END) {
+    throw std::runtime_error("Failed to compress data");
+  }
+
+  retVal.resize(strm.total_out);
+  return retVal;
+}
+
+static std::string Compress(const TileStreamMeta &meta, std::string_view data,
+                            bool swapEndian) {
+  switch (meta.compression) {
+  case TileCompression::Zlib: {
+    std::string retVal = Deflate(data, MAX_WBITS);
+
+    // Same sizes are treated as stored data by extractors
+    if (retVal.size() == data.size()) {
+      return std::string(data);
+    }
+
+    return retVal;
+  }
+  case TileCompression::SEGS: {
+    const uint32 numChunks =
+        (data.size() + SEGS_CHUNK_SIZE - 1) / SEGS_CHUNK_SIZE;
+    std::vector<SEGSChunk> chunks(numChunks);
+    std::string chunkData;
+    uint32 offset = sizeof(SEGS) + numChunks * sizeof(SEGSChunk);
+
+    for (uint32 c = 0; c < numChunks; c++) {
+      std::string_view chunk =
+          data.substr(c * SEGS_CHUNK_SIZE, SEGS_CHUNK_SIZE);
+      std::string compressed = Deflate(chunk, -MAX_WBITS);
+      chunks[c].compressedSize = compressed.size();
+      chunks[c].uncompressedSize = chunk.size();
+      chunks[c].offset = offset + 1;
+      offset += compressed.size();
+      chunkData.append(compressed);
+    }
+
+    SEGS hdr{CompileFourCC("sges"), meta.segsVersion, uint16(numChunks),
+             uint32(data.size()), offset};
+    std::stringstream str;
+    BinWritterRef_e wr(str);
+    wr.SwapEndian(swapEndian);
+    wr.Write(hdr);
+    wr.WriteContainer(chunks);
+    wr.WriteContainer(chunkData);
+
+    return std::move(str).str();
+  }
+  default:
+    return std::string(data);
+  }
+}
+
+struct TilePackWriter : AppPackContext {
+  TilePackWriter(const std::string &outPath_) : outPath(outPath_) {}
+
+  void SendFile(std::string_view path, std::istream &stream) override {
+    std::string data(std::istreambuf_iterator<char>(stream), {});
+    std::lock_guard lg(filesMutex);
+    files.emplace(path, std::move(data));
+  }
+
+  void Finish() override;
+
+private:
+  std::string_view File(const std::string &fileName) const {
+    auto found = files.find(fileName);
+
+    if (es::IsEnd(files, found)) {
+      throw es::FileNotFoundError(fileName);
+    }
+
+    return found->second;
+  }
+
+  std::string outPath;
+  std::mutex filesMutex;
+  std::map<std::string, std::string, std::less<>> files;
+};
+
+void TilePackWriter::Finish() {
+  auto startTime = std::chrono::steady_clock::now();
+  TilePackMeta meta;
+
+  {
+    MemoryStream metaStream(File("sbla.meta"));
+    BinReaderRef rd(metaStream);
+    rd.Read(meta);
+  }
+
+  MemoryStream headerStream(meta.header);
+  TilePackIndex index = ReadTilePackTables(headerStream);
+
+  if (index.entries.size() != meta.entries.size()) {
+    throw std::runtime_error("sbla.meta entries don't match its tables");
+  }
+
+  // Entry data can't be converted, so pack keeps endianness of original
+  const bool swapEndian = index.swappedEndian;
+  std::vector<std::string> payloads(meta.entries.size());
+  std::vector<uint32> uncompressedSizes(meta.entries.size());
+
+  RunParallel(meta.entries.size(), [&](size_t i) {
+    const TileEntryMeta &e = meta.entries[i];
+    std::string_view streams[2];
+
+    for (size_t s = 0; s < e.streams.size(); s++) {
+      if (!e.streams[s].fileName.empty()) {
+        streams[s] = File(e.streams[s].fileName);
+      }
+    }
+
+    std::stringstream str;
+    BinWritterRef_e wr(str);
+    wr.SwapEndian(swapEndian);
+
+    switch (e.type) {
+    case TileEntryType::Mesh: {
+      // Extracted .msh has MESH prefix
+      streams[0].remove_prefix(std::min<size_t>(streams[0].size(), 4));
+      std::string msh = Compress(e.streams.at(0), streams[0], swapEndian);
+      std::string dat = Compress(e.streams.at(1), streams[1], swapEndian);
+      MSHA msha{};
+      msha.id = MSHA_ID;
+      msha.uncompressedSize0 = streams[0].size();
+      msha.uncompressedSize1 = streams[1].size();
+      msha.compressedSize0 = msh.size();
+      msha.compressedSize1 = dat.size();
+      strncpy(msha.name, e.meshName.c_str(), sizeof(msha.name) - 1);
+      wr.Write(msha);
+      wr.WriteContainer(msh);
+      wr.WriteContainer(dat);
+      uncompressedSizes[i] = msha.uncompressedSize0 + msha.uncompressedSize1;
+      break;
+    }
+    case TileEntryType::Mask: {
+      std::string data = Compress(e.streams.at(0), streams[0], swapEndian);
+      Mask mask = e.mask;
+      mask.uncompressedSize = streams[0].size();
+      mask.size = data.size();
+      mask.Write(wr);
+      wr.WriteContainer(data);
+      uncompressedSizes[i] = mask.uncompressedSize;
+      break;
+    }
+    case TileEntryType::Texture:
+      // Extracted .dtex has DTEX prefix
+      streams[0].remove_prefix(std::min<size_t>(streams[0].size(), 4));
+      wr.WriteContainer(streams[0]);
+      uncompressedSizes[i] = streams[0].size();
+      break;
+    default:
+      wr.WriteContainer(Compress(e.streams.at(0), streams[0], swapEndian));
+      uncompressedSizes[i] = streams[0].size();
+      break;
+    }
+
+    payloads[i] = std::move(str).str();
+  });
+
+  std::ofstream outStream(outPath, std::ios::binary);
+
+  if (outStream.fail()) {
+    throw es::FileInvalidAccessError(outPath);
+  }
+
+  BinWritterRef_e wr(outStream);
+  wr.SwapEndian(swapEndian);
+  wr.Write(SBLA_ID);
+  wr.Write(index.metaSize);
+
+  if (index.heightPack) {
+    index.height.Write(wr);
+  } else {
+    wr.Write(index.meta);
+  }
+
+  uint32 curOffset = meta.header.size();
+
+  for (size_t i = 0; i < meta.entries.size(); i++) {
+    const TileEntryMeta &e = meta.entries[i];
+    HeiFile table = index.entries[i].table;
+    table.offset = curOffset + e.offsetBias;
+    table.size = payloads[i].size() + e.sizeBias;
+    table.uncompressedSize = uncompressedSizes[i] + e.uncompressedBias;
+    curOffset += payloads[i].size();
+    wr.Write(table);
+  }
+
+  for (auto &p : payloads) {
+    wr.WriteContainer(p);
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  PrintInfo("Written ", payloads.size(), " entries into ", outPath, " in ",
+            elapsed.count(), "s");
+}
+
+AppPackContext *AppNewArchive(const std::string &folder, const AppPackStats &) {
+  std::string outPath = folder;
+
+  while (outPath.ends_with('/') || outPath.ends_with('\\')) {
+    outPath.pop_back();
+  }
+
+  // Keep original pack, that is usually next to its extracted folder
+  return new TilePackWriter(outPath + "_new.pack");
+}
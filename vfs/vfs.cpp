@@ -0,0 +1,145 @@
+/*  SaboteurVFS
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "hashstorage.hpp"
+#include "project.h"
+#include "spike/app_context.hpp"
+#include "spike/master_printer.hpp"
+#include "spike/reflect/reflector.hpp"
+#include "vfs.hpp"
+#include <cinttypes>
+#include <fstream>
+#include <iostream>
+
+// Need some anchor point, since loosefiles is stored all around
+std::string_view filters[]{
+    "*nimations.pack$",
+};
+
+struct SaboteurVFS : ReflectorBase<SaboteurVFS> {
+  std::string command = "ls";
+  std::string path;
+  std::string output;
+} settings;
+
+REFLECT(CLASS(SaboteurVFS),
+        MEMBER(command, "c",
+               ReflDesc{"ls lists directory, stat prints file details, cat "
+                        "writes file contents."}),
+        MEMBER(path, "p",
+               ReflDesc{"Virtual path, archive path followed by asset name, "
+                        "for example mega0.megapack/1234/rock.msh."}),
+        MEMBER(output, "o",
+               ReflDesc{"Output of cat, file or pipe path, - for standard "
+                        "output. Empty writes file into working folder."}));
+
+static AppInfo_s appInfo{
+    .filteredLoad = true,
+    .header = SaboteurVFS_DESC " v" SaboteurVFS_VERSION
+                               ", " SaboteurVFS_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
+    .filters = filters,
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+bool AppInitContext(const std::string &dataFolder) {
+  hash::LoadStorage(dataFolder + "saboteur_strings.txt");
+  return true;
+}
+
+static void Cat(AppContext *ctx, const VFSFile &file) {
+  static constexpr size_t CHUNK_SIZE = 0x100000;
+  std::ofstream outFile;
+  std::ostream *str = &std::cout;
+
+  if (settings.output.empty()) {
+    const size_t lastSlash = settings.path.find_last_of("/\\");
+    str = &ctx->NewFile(settings.path.substr(lastSlash + 1)).str;
+  } else if (settings.output != "-") {
+    outFile.open(settings.output, std::ios::binary);
+
+    if (outFile.fail()) {
+      throw es::FileInvalidAccessError(settings.output);
+    }
+
+    str = &outFile;
+  }
+
+  std::string buffer(CHUNK_SIZE, 0);
+
+  // Only blocks of current chunk are inflated at once
+  for (uint64 offset = 0; offset < file.Size(); offset += CHUNK_SIZE) {
+    const size_t numRead = file.Read(offset, buffer.data(), CHUNK_SIZE);
+    str->write(buffer.data(), numRead);
+
+    if (numRead < CHUNK_SIZE) {
+      break;
+    }
+  }
+
+  str->flush();
+}
+
+void AppProcessFile(AppContext *ctx) {
+  const VirtualFileSystem vfs(std::string(ctx->workingFile.GetFolder()));
+
+  if (settings.command == "ls") {
+    std::string report;
+    char buffer[64];
+
+    for (auto &s : vfs.List(settings.path)) {
+      snprintf(buffer, sizeof(buffer), "%c%c %12" PRIu64 "  ",
+               s.directory ? 'd' : '-', s.file ? 'f' : '-', s.size);
+      report.append(buffer).append(s.path).push_back('\n');
+    }
+
+    PrintInfo(report);
+  } else if (settings.command == "stat") {
+    const std::optional<VFSStat> stat = vfs.Stat(settings.path);
+
+    if (!stat) {
+      throw es::FileNotFoundError(settings.path);
+    }
+
+    PrintInfo("path: ", stat->path, "\ndirectory: ", stat->directory,
+              "\nfile: ", stat->file, "\nsize: ", stat->size);
+
+    if (const CatalogRecord *r = stat->record) {
+      const VFSFile file = vfs.Open(settings.path);
+      size_t numCompressed = 0;
+
+      for (auto &b : file.Blocks()) {
+        numCompressed += b.codec != VFSCodec::Stored;
+      }
+
+      char hash[16];
+      snprintf(hash, sizeof(hash), "%08" PRIX32, r->hash);
+      PrintInfo("hash: ", hash,
+                "\ntype: ", CATALOG_TYPE_NAMES[uint8(r->type)],
+                "\narchive: ", vfs.Catalog().Archive(*r),
+                "\noffset: ", r->offset,
+                "\ncompressedSize: ", r->compressedSize,
+                "\nblocks: ", file.Blocks().size(), " (", numCompressed,
+                " compressed)");
+    }
+  } else if (settings.command == "cat") {
+    Cat(ctx, vfs.Open(settings.path));
+  } else {
+    throw std::runtime_error("Unknown command: " + settings.command);
+  }
+}